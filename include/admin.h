@@ -0,0 +1,25 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+/* How long the admin thread waits for a connected client's command */
+#define ADMIN_TIMEOUT_MS 1000
+
+/*
+ * Admin socket: a unix socket served by its own thread, so a slow reader
+ * never holds up a relay. A client writes one command line and reads the
+ * answer until the socket closes:
+ *
+ *   flightrec   the flight recorder's events, oldest first
+ *   metrics     how many events of each type were recorded, followed by
+ *               whatever the providers added with admin_add_metrics() write
+ */
+int admin_start(const char *path);
+void admin_stop(void);
+
+/* Providers the metrics command calls in turn, from the admin thread */
+#define ADMIN_MAX_METRICS 16
+
+int admin_add_metrics(int (*metrics)(int fd, void *arg), void *arg);
+void admin_remove_metrics(int (*metrics)(int fd, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+/* "DZCAP" and the format version, the first bytes of every capture */
+#define CAPTURE_MAGIC "DZCAP\0\0\1"
+#define CAPTURE_MAGIC_SIZE 8
+/* Longest pause a record can hold, the most a five byte varint does */
+#define CAPTURE_MAX_GAP_NS ((1ull << 35) - 1)
+/* Records gathered before one write() */
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+
+/*
+ * Capture of every frame clients send, for replaying the traffic later with
+ * tools/replay. After the magic comes the wall clock time of the capture's
+ * start in ns, 8 bytes big-endian, then one record per frame: the ns since
+ * the previous record and the sender's client id as prefix varints (see
+ * wire.h), the frame's 4-byte length word and its payload. Longer pauses
+ * are recorded as CAPTURE_MAX_GAP_NS. Records are buffered and reach the
+ * file in whole batches.
+ */
+struct Capture
+{
+    int fd;
+    uint64_t last_ns;
+    size_t pos;
+    char buffer[CAPTURE_BUFFER_SIZE];
+};
+
+int capture_open(struct Capture *capture, const char *path, uint64_t now);
+int capture_frame(struct Capture *capture, uint64_t client_id, uint64_t now, const struct FrameView *view);
+int capture_flush(struct Capture *capture);
+void capture_close(struct Capture *capture);
+
+#endif
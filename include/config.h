@@ -0,0 +1,23 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * Read section [name] of an INI-style configuration file:
+ *
+ *   [name]
+ *   port = 8080
+ *   maxClients = 10
+ *   logLevel = notice          # syslog priority: err, warning, notice, info, debug or 0-7
+ *   logFile = /var/log/daemonize.log
+ *   tlsCert = /etc/daemonize/cert.pem  # PEM chain and key, serve clients over TLS (make TLS=1)
+ *   tlsKey = /etc/daemonize/key.pem
+ *
+ * Blank lines and lines starting with # or ; are ignored, as are keys this
+ * version does not know. Values not given keep what the caller set; a
+ * logFile, tlsCert or tlsKey is malloc'd. Returns -1, after logging why, if the file cannot
+ * be read, has no such section or holds a bad value.
+ */
+int readConfig(const char *file, const char *name, int *port, int *maxClients, int *logLevel, char **logFile,
+               char **tlsCert, char **tlsKey);
+
+#endif
@@ -1,43 +1,73 @@
 #ifndef DAEMONIZE_H
 #define DAEMONIZE_H
 
-// #ifdef __linux__
-// #include <syslog.h>
-// #include <sys/socket.h>
-// #include <netinet/in.h>
-// #elif WINDOWS
-// #include <winsock.h>
-// #endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define DAEMONIZE_VERSION "0.1.0"
+
+#include "parser.h"
+#include "journal.h"
+#include "outq.h"
+#include "lvc.h"
+#include "ratelimit.h"
+#include "zerocopy.h"
+#include "splice.h"
+#include "tls.h"
+#include "peer.h"
+#include "shm.h"
+#include "route.h"
 
 #define BUFFER_SIZE 100
 
+/* Control frame opcodes, the first payload byte of a control frame */
+#define CTRL_REPLAY_SEQ 1  /* 8-byte big-endian sequence number follows */
+#define CTRL_REPLAY_TIME 2 /* 8-byte big-endian wall clock time in ns follows */
+#define CTRL_PEER_HELLO 3  /* 8-byte big-endian node id of the sender follows */
+#define CTRL_PEER_FRAME 4  /* 8-byte big-endian origin node id, then the payload */
+#define CTRL_SHM_OPEN 5    /* 8-byte big-endian ring size, the first frame on the unix socket */
+#define CTRL_ROUTE 6       /* 8-byte big-endian client id, 8-byte correlation id, then the payload */
+#define CTRL_CLIENT_ID 7   /* Asks for, and answered with, the 8-byte big-endian id of the client */
+#define CTRL_UNREACHABLE 8 /* Header of a CTRL_ROUTE frame whose target is not connected */
+
 struct ClientConnection
 {
-    int sockfd;
+    int socket;
+    int poll_slot; /* Its entry in the loop pass's poll set, -1 if it is not polled */
+    uint64_t id; /* Assigned at accept, addresses CTRL_ROUTE frames */
     int pos;
     struct sockaddr_in addr;
     socklen_t addr_len;
+    char buffer[FRAME_BUFFER_SIZE];
+    int closing;
+    int replaying;
+    struct JournalCursor replay;
+    int replay_op;        /* CTRL_REPLAY_SEQ or CTRL_REPLAY_TIME waiting for the client to go idle */
+    uint64_t replay_from; /* Sequence number or time of that request */
+    struct OutQueue outq;
+    struct ConflateSet conflate;
+    struct TokenBucket frame_bucket;
+    struct TokenBucket byte_bucket;
+    struct ZeroCopy zc;
+    struct SplicePipe in_pipe;  /* Payload of a large frame being passed through */
+    struct SplicePipe out_pipe; /* Spliced frame bytes the socket has not taken yet */
+    size_t splice_left;
+    uint32_t splice_flags;
+    int splice_refused; /* The frame at the head of buffer is read into it, its pipe filled up */
+    struct ssl_st *tls;
+    int handshaking; /* TLS_WANT_READ or TLS_WANT_WRITE until the TLS or shm handshake is done */
+    struct ShmChannel *shm; /* Rings of a client on the unix socket, frames go through them only */
+    int shm_slot;           /* Poll set entry of the shm eventfd */
+    int connecting;  /* A dialed peer link whose connect is in progress */
+    int peer;        /* PEER_NONE, PEER_DIALED or PEER_ACCEPTED */
+    uint64_t peer_id; /* Node at the other end of a link, 0 until its hello */
+    int peer_standby; /* A second link to the same node, unused while the first is up */
+    int backlog;
+    void *user; /* Owned by the embedding program */
     struct ClientConnection *next;
     struct ClientConnection *prev;
 };
 
-struct RequestHandler
-{
-    struct ClientConnection *client;
-    void (*handle_request)(struct ClientConnection *client);
-};
-
-struct Connection
-{
-    struct RequestHandler *request_handler;
-    struct sockaddr_in addr;
-    socklen_t addr_len;
-    struct Connection *next;
-    struct Connection *prev;
-};
-
-extern struct Connection *connection_head;
-extern struct Connection *connection_current;
-
 int daemonize(const char *dir, const char *pidfile, int logfd);
+const char *getVersion(void);
 #endif
\ No newline at end of file
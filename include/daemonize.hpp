@@ -0,0 +1,222 @@
+#ifndef DAEMONIZE_HPP
+#define DAEMONIZE_HPP
+
+/*
+ * Header-only C++ API over libdaemonize. Server<Handler> owns one relay and
+ * calls the handler through statically bound trampolines, so there is no
+ * virtual dispatch and no allocation per frame. Any number of servers may
+ * run in one process, each driven by its own thread or interleaved with
+ * run_once(). Handlers must not throw; an exception escaping a callback
+ * terminates the program.
+ */
+
+extern "C" {
+#include "daemonize.h"
+#include "relay.h"
+#include "frame.h"
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace relay
+{
+
+/* A frame owned by reference, ready to be sent to any number of clients */
+class Buffer
+{
+public:
+    Buffer() noexcept = default;
+
+    Buffer(std::string_view payload, uint32_t flags = 0)
+        : frame_(frame_new(payload.data(), static_cast<uint32_t>(payload.size()), flags))
+    {
+        if (frame_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    Buffer(Buffer &&other) noexcept : frame_(std::exchange(other.frame_, nullptr)) {}
+
+    Buffer &operator=(Buffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            frame_unref(frame_);
+            frame_ = std::exchange(other.frame_, nullptr);
+        }
+        return *this;
+    }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    ~Buffer() { frame_unref(frame_); }
+
+    /* Payload only, without the length word */
+    std::string_view payload() const noexcept
+    {
+        return frame_ != nullptr ? std::string_view(frame_->data + 4, frame_->len - 4) : std::string_view();
+    }
+    uint32_t flags() const noexcept { return frame_ != nullptr ? frame_->flags : 0; }
+    explicit operator bool() const noexcept { return frame_ != nullptr; }
+    struct Frame *get() const noexcept { return frame_; }
+    /* Give up the reference, the buffer is empty afterwards */
+    struct Frame *release() noexcept { return std::exchange(frame_, nullptr); }
+
+private:
+    struct Frame *frame_ = nullptr;
+};
+
+/* A client of a relay, valid from on_accept until on_close returns */
+class Connection
+{
+public:
+    Connection(struct Relay *relay, struct ClientConnection *client) noexcept : relay_(relay), client_(client) {}
+
+    int fd() const noexcept { return client_->socket; }
+    /* What other clients address this one by in CTRL_ROUTE frames */
+    uint64_t id() const noexcept { return client_->id; }
+
+    bool send(std::string_view payload, uint32_t flags = 0) noexcept
+    {
+        return relay_send(relay_, client_, payload.data(), static_cast<uint32_t>(payload.size()), flags) == 0;
+    }
+    bool send(const Buffer &buffer) noexcept { return relay_send_frame(relay_, client_, buffer.get()) == 0; }
+
+    /* Relay as if this client had sent the frame itself */
+    bool broadcast(std::string_view payload, uint32_t flags = 0) noexcept
+    {
+        return relay_broadcast(relay_, client_, payload.data(), static_cast<uint32_t>(payload.size()), flags) == 0;
+    }
+    bool broadcast(const Buffer &buffer) noexcept { return relay_broadcast_frame(relay_, client_, buffer.get()) == 0; }
+
+    /* Dropped at the end of the current loop iteration */
+    void close() noexcept { relay_close(relay_, client_); }
+
+    void *user() const noexcept { return client_->user; }
+    void user(void *user) noexcept { client_->user = user; }
+
+    struct ClientConnection *get() const noexcept { return client_; }
+
+private:
+    struct Relay *relay_;
+    struct ClientConnection *client_;
+};
+
+/* Default callbacks: relay every frame, ignore everything else */
+struct Handler
+{
+    void on_accept(Connection) noexcept {}
+    bool on_frame(Connection, std::string_view, uint32_t) noexcept { return true; }
+    void on_close(Connection) noexcept {}
+    void on_drain(Connection) noexcept {}
+};
+
+inline struct RelayConfig default_config() noexcept
+{
+    struct RelayConfig config;
+
+    relay_config_init(&config);
+    return config;
+}
+
+/*
+ * One relay instance bound to handler, which must outlive the server. The
+ * listening sockets are open once the constructor returns. A handler that
+ * overrides on_frame sees every frame in memory, so large frames are not
+ * spliced past it (RelayConfig.spliceMin); one that keeps Handler's does
+ * not get it called at all.
+ */
+template <class H>
+class Server
+{
+public:
+    Server(const struct RelayConfig &config, H &handler)
+    {
+        struct RelayHandler callbacks = {on_accept, sees_frames ? on_frame : nullptr, on_close, on_drain, &handler};
+
+        relay_ = relay_new(&config, &callbacks);
+        if (relay_ == nullptr)
+            throw std::bad_alloc();
+        if (relay_listen(relay_) != 0)
+        {
+            relay_free(relay_);
+            throw std::runtime_error("daemonize: failed to open relay sockets");
+        }
+    }
+
+    Server(Server &&other) noexcept : relay_(std::exchange(other.relay_, nullptr)) {}
+    Server &operator=(Server &&other) noexcept
+    {
+        if (this != &other)
+        {
+            relay_free(relay_);
+            relay_ = std::exchange(other.relay_, nullptr);
+        }
+        return *this;
+    }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    ~Server() { relay_free(relay_); }
+
+    /* Loop until stop(), returns false if waiting for activity failed */
+    bool run() noexcept { return relay_run(relay_) == 0; }
+    bool run_once(int timeout_ms) noexcept { return relay_run_once(relay_, timeout_ms) == 0; }
+    /* Safe from a signal handler or a callback */
+    void stop() noexcept { relay_stop(relay_); }
+
+    bool broadcast(std::string_view payload, uint32_t flags = 0) noexcept
+    {
+        return relay_broadcast(relay_, nullptr, payload.data(), static_cast<uint32_t>(payload.size()), flags) == 0;
+    }
+    bool broadcast(const Buffer &buffer) noexcept { return relay_broadcast_frame(relay_, nullptr, buffer.get()) == 0; }
+
+    /* Broadcast from any thread; buffer is left as is if the inbox is full */
+    bool post(Buffer &buffer) noexcept
+    {
+        struct Frame *frame = buffer.get();
+
+        if (frame == nullptr || relay_post(relay_, &frame, 1) != 1)
+            return false;
+        buffer.release();
+        return true;
+    }
+
+    struct Relay *get() const noexcept { return relay_; }
+
+private:
+    static constexpr bool sees_frames = !std::is_same_v<decltype(&H::on_frame), decltype(&Handler::on_frame)>;
+
+    static void on_accept(struct Relay *relay, struct ClientConnection *client, void *arg) noexcept
+    {
+        static_cast<H *>(arg)->on_accept(Connection(relay, client));
+    }
+
+    static int on_frame(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view, void *arg) noexcept
+    {
+        return static_cast<H *>(arg)->on_frame(Connection(relay, client), std::string_view(view->msg, view->len), view->flags);
+    }
+
+    static void on_close(struct Relay *relay, struct ClientConnection *client, void *arg) noexcept
+    {
+        static_cast<H *>(arg)->on_close(Connection(relay, client));
+    }
+
+    static void on_drain(struct Relay *relay, struct ClientConnection *client, void *arg) noexcept
+    {
+        static_cast<H *>(arg)->on_drain(Connection(relay, client));
+    }
+
+    struct Relay *relay_ = nullptr;
+};
+
+} // namespace relay
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef DAEMONIZE_CORO_HPP
+#define DAEMONIZE_CORO_HPP
+
+/*
+ * C++20 coroutine handlers on top of daemonize.hpp. CoroServer starts one
+ * coroutine per accepted client, taking the client's Stream:
+ *
+ *     relay::Task serve(relay::Stream &stream)
+ *     {
+ *         while (auto msg = co_await stream.read_frame())
+ *             co_await stream.write(msg->payload);
+ *     }
+ *
+ * The coroutines run on the thread driving the relay and are resumed from
+ * its callbacks, so nothing blocks and nothing is locked. read_frame() hands
+ * out the frame straight from the receive buffer when the coroutine is
+ * already waiting for it; the payload stays valid until the next co_await.
+ * write() queues the frame like any relayed frame and only suspends while
+ * the client's socket is full. Coroutine frames come from a per-server pool
+ * of size classes, so a steady stream of connections does not touch the
+ * heap. Handlers must not throw.
+ */
+
+#include "daemonize.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace relay
+{
+
+/* Free lists of coroutine frames, in GRAIN sized classes; single-threaded */
+class FramePool
+{
+public:
+    static constexpr std::size_t GRAIN = 64;
+    static constexpr std::size_t CLASSES = 32;
+
+    FramePool() noexcept = default;
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    ~FramePool()
+    {
+        for (Block *&head : free_)
+        {
+            while (head != nullptr)
+                ::operator delete(std::exchange(head, head->next));
+        }
+    }
+
+    void *allocate(std::size_t size)
+    {
+        std::size_t c = (size + GRAIN - 1) / GRAIN;
+
+        if (c >= CLASSES)
+            return ::operator new(size);
+        if (free_[c] != nullptr)
+            return std::exchange(free_[c], free_[c]->next);
+        return ::operator new(c * GRAIN);
+    }
+
+    void deallocate(void *p, std::size_t size) noexcept
+    {
+        std::size_t c = (size + GRAIN - 1) / GRAIN;
+
+        if (c >= CLASSES)
+        {
+            ::operator delete(p);
+            return;
+        }
+        free_[c] = new (p) Block{free_[c]};
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    Block *free_[CLASSES] = {};
+};
+
+/* A frame handed to a coroutine, valid until its next co_await */
+struct Message
+{
+    std::string_view payload;
+    uint32_t flags;
+};
+
+class Stream;
+
+namespace detail
+{
+
+inline Stream *find_stream(Stream *found) noexcept { return found; }
+
+template <class T, class... A>
+Stream *find_stream(Stream *found, T &arg, A &...args) noexcept
+{
+    if constexpr (std::is_same_v<T, Stream>)
+        return find_stream(&arg, args...);
+    else
+        return find_stream(found, args...);
+}
+
+} // namespace detail
+
+/*
+ * The client side of one coroutine, owned by the server. Once the client is
+ * gone, read_frame() yields nullopt and write() false.
+ */
+class Stream
+{
+public:
+    class ReadFrame
+    {
+    public:
+        explicit ReadFrame(Stream &stream) noexcept : stream_(stream) {}
+
+        bool await_ready() noexcept { return stream_.take(result_); }
+        void await_suspend(std::coroutine_handle<> waiter) noexcept
+        {
+            stream_.reader_ = this;
+            stream_.waiter_ = waiter;
+        }
+        std::optional<Message> await_resume() noexcept { return result_; }
+
+    private:
+        friend class Stream;
+        Stream &stream_;
+        std::optional<Message> result_;
+    };
+
+    class Write
+    {
+    public:
+        Write(Stream &stream, bool queued) noexcept : stream_(stream), ok_(queued) {}
+
+        /* Carry on unless the frame is stuck behind a full socket */
+        bool await_ready() noexcept { return !ok_ || !stream_.conn_.get()->outq.blocked; }
+        void await_suspend(std::coroutine_handle<> waiter) noexcept
+        {
+            stream_.writer_ = this;
+            stream_.waiter_ = waiter;
+        }
+        bool await_resume() noexcept { return ok_; }
+
+    private:
+        friend class Stream;
+        Stream &stream_;
+        bool ok_;
+    };
+
+    Stream(Connection conn, FramePool &pool) noexcept : conn_(conn), pool_(pool) {}
+    Stream(const Stream &) = delete;
+    Stream &operator=(const Stream &) = delete;
+
+    ReadFrame read_frame() noexcept { return ReadFrame(*this); }
+
+    Write write(std::string_view payload, uint32_t flags = 0) noexcept
+    {
+        return Write(*this, !closed_ && conn_.send(payload, flags));
+    }
+    Write write(const Buffer &buffer) noexcept { return Write(*this, !closed_ && conn_.send(buffer)); }
+
+    void close() noexcept
+    {
+        if (!closed_)
+            conn_.close();
+    }
+    bool closed() const noexcept { return closed_; }
+
+    /* The underlying client, only valid while !closed() */
+    Connection &connection() noexcept { return conn_; }
+    FramePool &pool() noexcept { return pool_; }
+
+    /* Called by the server's callbacks */
+    void deliver(std::string_view payload, uint32_t flags)
+    {
+        if (reader_ == nullptr)
+        {
+            backlog_.emplace_back(payload, flags);
+            return;
+        }
+        std::exchange(reader_, nullptr)->result_ = Message{payload, flags};
+        waiter_.resume();
+    }
+
+    void drained() noexcept
+    {
+        if (writer_ != nullptr)
+        {
+            writer_ = nullptr;
+            waiter_.resume();
+        }
+    }
+
+    /* The client is gone: wake the coroutine, true if the stream can be freed */
+    bool hangup() noexcept
+    {
+        closed_ = true;
+        if (reader_ != nullptr)
+        {
+            std::exchange(reader_, nullptr)->result_.reset();
+            waiter_.resume();
+        }
+        else if (writer_ != nullptr)
+        {
+            std::exchange(writer_, nullptr)->ok_ = false;
+            waiter_.resume();
+        }
+        /* A coroutine suspended elsewhere frees the stream when it returns */
+        orphaned_ = !finished_;
+        return finished_;
+    }
+
+    /* The coroutine returned: close the client, free an orphaned stream */
+    void finish() noexcept
+    {
+        finished_ = true;
+        if (orphaned_)
+            delete this;
+        else
+            close();
+    }
+
+private:
+    bool take(std::optional<Message> &result)
+    {
+        if (!backlog_.empty())
+        {
+            current_ = std::move(backlog_.front());
+            backlog_.pop_front();
+            result = Message{current_.payload(), current_.flags()};
+            return true;
+        }
+        /* Nothing left and nothing coming, read_frame yields nullopt */
+        return closed_;
+    }
+
+    Connection conn_;
+    FramePool &pool_;
+    std::coroutine_handle<> waiter_;
+    ReadFrame *reader_ = nullptr;
+    Write *writer_ = nullptr;
+    /* Frames that arrived while the coroutine was busy writing */
+    std::deque<Buffer> backlog_;
+    Buffer current_;
+    bool closed_ = false;
+    bool finished_ = false;
+    bool orphaned_ = false;
+};
+
+/*
+ * Return type of a connection coroutine. It starts eagerly, runs until its
+ * first suspension and frees itself when it returns.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        template <class... A>
+        explicit promise_type(A &...args) noexcept : stream(detail::find_stream(nullptr, args...))
+        {
+        }
+
+        /* Frames are prefixed with the pool they came from and their size */
+        template <class... A>
+        static void *operator new(std::size_t size, A &...args)
+        {
+            Stream *owner = detail::find_stream(nullptr, args...);
+            FramePool *pool = owner != nullptr ? &owner->pool() : nullptr;
+            Header *header;
+
+            size += sizeof(Header);
+            header = static_cast<Header *>(pool != nullptr ? pool->allocate(size) : ::operator new(size));
+            header->pool = pool;
+            header->size = size;
+            return header + 1;
+        }
+
+        static void operator delete(void *frame) noexcept
+        {
+            Header *header = static_cast<Header *>(frame) - 1;
+
+            if (header->pool != nullptr)
+                header->pool->deallocate(header, header->size);
+            else
+                ::operator delete(header);
+        }
+
+        Task get_return_object() noexcept { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept
+        {
+            if (stream != nullptr)
+                stream->finish();
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        Stream *stream;
+    };
+
+private:
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header
+    {
+        FramePool *pool;
+        std::size_t size;
+    };
+};
+
+/*
+ * A relay whose clients are each served by serve(stream), a callable
+ * returning Task. Frames go to the coroutine only and are never relayed
+ * unless it does so itself through stream.connection().broadcast().
+ */
+template <class F>
+class CoroServer
+{
+public:
+    CoroServer(const struct RelayConfig &config, F serve) : handler_(std::move(serve), pool_), server_(config, handler_) {}
+
+    CoroServer(const CoroServer &) = delete;
+    CoroServer &operator=(const CoroServer &) = delete;
+
+    bool run() noexcept { return server_.run(); }
+    bool run_once(int timeout_ms) noexcept { return server_.run_once(timeout_ms); }
+    void stop() noexcept { server_.stop(); }
+    bool broadcast(std::string_view payload, uint32_t flags = 0) noexcept { return server_.broadcast(payload, flags); }
+    bool broadcast(const Buffer &buffer) noexcept { return server_.broadcast(buffer); }
+    struct Relay *get() const noexcept { return server_.get(); }
+
+private:
+    struct Adapter : Handler
+    {
+        Adapter(F serve, FramePool &pool) : serve(std::move(serve)), pool(pool) {}
+
+        void on_accept(Connection conn) noexcept
+        {
+            Stream *stream = new Stream(conn, pool);
+
+            conn.user(stream);
+            serve(*stream);
+        }
+
+        bool on_frame(Connection conn, std::string_view payload, uint32_t flags) noexcept
+        {
+            static_cast<Stream *>(conn.user())->deliver(payload, flags);
+            return false;
+        }
+
+        void on_close(Connection conn) noexcept
+        {
+            Stream *stream = static_cast<Stream *>(conn.user());
+
+            if (stream->hangup())
+                delete stream;
+        }
+
+        void on_drain(Connection conn) noexcept { static_cast<Stream *>(conn.user())->drained(); }
+
+        F serve;
+        FramePool &pool;
+    };
+
+    /* Declared in teardown order: clients are dropped before the pool goes */
+    FramePool pool_;
+    Adapter handler_;
+    Server<Adapter> server_;
+};
+
+} // namespace relay
+
+#endif
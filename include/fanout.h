@@ -0,0 +1,39 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Sender threads one relay may start */
+#define FANOUT_MAX_THREADS 64
+/* Recipients a thread claims at a time */
+#define FANOUT_CHUNK 256
+
+/*
+ * A pool of threads that work through a job's items in chunks alongside the
+ * thread that posts it. fanout_run() returns once every item is done, so
+ * the job's data belongs to the caller again and nothing it shares with the
+ * workers needs locking beyond what the job itself touches.
+ */
+struct Fanout
+{
+    pthread_t threads[FANOUT_MAX_THREADS];
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; /* A job was posted or the pool is stopping */
+    pthread_cond_t done; /* The last worker on a job left it */
+    unsigned long job;   /* Bumped per job */
+    int open;            /* Workers waking up may still join the job */
+    int joined;          /* Workers inside the job */
+    int stop;
+    void (*work)(void *arg, size_t begin, size_t end);
+    void *arg;
+    size_t items;
+    size_t next; /* First item nobody has claimed yet */
+};
+
+int fanout_start(struct Fanout *fanout, int threads);
+void fanout_run(struct Fanout *fanout, size_t items, void (*work)(void *arg, size_t begin, size_t end), void *arg);
+void fanout_stop(struct Fanout *fanout);
+
+#endif
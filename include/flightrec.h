@@ -0,0 +1,66 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+
+/* Events kept, a power of two */
+#define FLIGHTREC_EVENTS 4096
+
+/* Event types; a and b carry the values noted */
+#define FR_ACCEPT 0     /* new client */
+#define FR_FRAME 1      /* len, flags of a complete frame read */
+#define FR_SEND 2       /* len, bytes sent directly to one recipient */
+#define FR_FLUSH 3      /* result, bytes still queued after a flush */
+#define FR_DISCONNECT 4 /* client dropped */
+#define FR_ERROR 5      /* errno, relay.c line it was recorded at */
+#define FR_TYPES 6
+
+struct FlightEvent
+{
+    uint64_t seq; /* 1 + the event's number, 0 while being written */
+    uint64_t time_ns;
+    uint32_t type;
+    int32_t fd;
+    int64_t a;
+    int64_t b;
+};
+
+/*
+ * Flight recorder: the last FLIGHTREC_EVENTS events of every relay in the
+ * process, and a count of each type. A writer claims a slot with a single
+ * atomic increment and fills it with plain stores, bracketed by the slot's
+ * seq like a seqlock, so recording costs a few nanoseconds and never
+ * waits; a reader skips slots that change while it copies them. Dumps
+ * only use async-signal-safe calls, so they can run from signal handlers.
+ */
+struct FlightRecorder
+{
+    uint64_t next;
+    uint64_t counts[FR_TYPES];
+    struct FlightEvent events[FLIGHTREC_EVENTS];
+};
+
+extern struct FlightRecorder flightrec;
+
+static inline void flightrec_record(uint32_t type, int fd, int64_t a, int64_t b, uint64_t time_ns)
+{
+    uint64_t seq = __atomic_fetch_add(&flightrec.next, 1, __ATOMIC_RELAXED);
+    struct FlightEvent *event = &flightrec.events[seq & (FLIGHTREC_EVENTS - 1)];
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&event->time_ns, time_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->type, type, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->fd, fd, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->a, a, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->b, b, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&flightrec.counts[type], 1, __ATOMIC_RELAXED);
+}
+
+int flightrec_dump(int fd);
+int flightrec_dump_file(const char *path);
+int flightrec_metrics(int fd);
+int flightrec_install(const char *path);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef FQUEUE_H
+#define FQUEUE_H
+
+#include <stdint.h>
+
+struct Frame;
+
+/* fq_init() flags, a side used by one thread only skips its compare-and-swap */
+#define FQ_SINGLE_PRODUCER 1
+#define FQ_SINGLE_CONSUMER 2
+
+struct FqCell
+{
+    uint64_t seq;
+    struct Frame *frame;
+};
+
+/*
+ * Bounded lock-free queue of frame handles between threads, after Vyukov's
+ * MPMC array queue. Each cell carries a sequence number telling whether it
+ * is free for position pos (seq == pos) or holds the frame for it (seq ==
+ * pos + 1), so producers and consumers only ever contend on their own
+ * index. Batches claim a run of cells with one compare-and-swap. The queue
+ * moves references, it does not take them: whoever pops a frame owns the
+ * reference its producer gave up, and must release it on a thread allowed
+ * to, see frame.h.
+ */
+struct FrameQueue
+{
+    struct FqCell *cells;
+    uint64_t mask;
+    int flags;
+    uint64_t head __attribute__((aligned(64))); /* Next position to fill */
+    uint64_t tail __attribute__((aligned(64))); /* Next position to drain */
+};
+
+int fq_init(struct FrameQueue *queue, uint64_t size, int flags);
+void fq_free(struct FrameQueue *queue);
+unsigned int fq_push(struct FrameQueue *queue, struct Frame *const *frames, unsigned int count);
+unsigned int fq_pop(struct FrameQueue *queue, struct Frame **frames, unsigned int count);
+int fq_empty(struct FrameQueue *queue);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+/*
+ * A relayed frame in wire format (4-byte big-endian length word carrying
+ * flags, then payload), shared by reference between every queue it sits in.
+ * Frames from a relay's pool go back to it and must be released on the
+ * thread that drives that relay.
+ */
+struct Frame
+{
+    struct Pool *pool;
+    struct FrameMemory *memory; /* Whose budget the frame counts against, NULL for nobody's */
+    unsigned int refs;
+    uint32_t flags;
+    uint32_t len;
+    char data[];
+};
+
+struct Frame *frame_alloc(uint32_t msg_len, uint32_t flags);
+struct Frame *frame_new(const char *msg, uint32_t msg_len, uint32_t flags);
+struct Frame *frame_alloc_in(struct Pool *pool, uint32_t msg_len, uint32_t flags);
+struct Frame *frame_new_in(struct Pool *pool, const char *msg, uint32_t msg_len, uint32_t flags);
+struct Frame *frame_ref(struct Frame *frame);
+void frame_unref(struct Frame *frame);
+
+/*
+ * Bytes of the live frames charged to one owner, such as a relay. Each
+ * charged frame holds a reference, so a frame that outlives its owner can
+ * still be freed.
+ */
+struct FrameMemory
+{
+    size_t bytes;
+    unsigned int refs;
+};
+
+struct FrameMemory *frame_memory_new(void);
+void frame_memory_release(struct FrameMemory *memory);
+size_t frame_memory(const struct FrameMemory *memory);
+void frame_charge(struct Frame *frame, struct FrameMemory *memory);
+
+#endif
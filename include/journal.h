@@ -0,0 +1,63 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define JOURNAL_SEGMENT_SIZE (64 * 1024 * 1024)
+/* Bytes of frames between two sparse index entries */
+#define JOURNAL_INDEX_INTERVAL (64 * 1024)
+/* Sealed segments kept on disk before the oldest is deleted */
+#define JOURNAL_MAX_SEGMENTS 16
+/* Bytes sent to one replaying client per loop iteration */
+#define JOURNAL_REPLAY_CHUNK (256 * 1024)
+
+struct JournalIndexEntry
+{
+    uint64_t seq;
+    uint64_t time_ns;
+    uint32_t segment;
+    uint32_t offset;
+};
+
+/*
+ * Append-only frame journal. Frames are stored in wire format (4-byte
+ * big-endian length word, flag bits such as FRAME_PRIORITY included,
+ * followed by the payload) in mmap'd segment files, so a replay is a plain
+ * sendfile() of a segment range straight from the page cache. Every JOURNAL_INDEX_INTERVAL bytes a (seq, time, position) entry is
+ * added to the segment's .idx file.
+ */
+struct Journal
+{
+    char dir[256];
+    uint32_t first_segment;
+    uint32_t segment;
+    int fd;
+    int index_fd;
+    char *base;
+    size_t pos;
+    size_t last_indexed;
+    uint64_t next_seq;
+    struct JournalIndexEntry *index;
+    size_t index_count;
+    size_t index_cap;
+};
+
+/* Replay position of one client */
+struct JournalCursor
+{
+    int fd;
+    uint32_t segment;
+    off_t offset;
+};
+
+int journal_open(struct Journal *journal, const char *dir);
+int journal_append(struct Journal *journal, const char *msg, uint32_t len, uint32_t flags);
+int journal_seek_seq(struct Journal *journal, uint64_t seq, struct JournalCursor *cursor);
+int journal_seek_time(struct Journal *journal, uint64_t time_ns, struct JournalCursor *cursor);
+int journal_replay(struct Journal *journal, struct JournalCursor *cursor, int sockfd);
+void journal_cursor_close(struct JournalCursor *cursor);
+void journal_close(struct Journal *journal);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <syslog.h>
+
+/* Syslog priority of the least urgent message logged, LOG_NOTICE unless configured */
+extern int logLevel;
+
+/*
+ * Log a printf-style message at LOG_ERR, LOG_NOTICE or LOG_DEBUG, to syslog
+ * and to stderr, which is the terminal until the process daemonizes and the
+ * configured log file after.
+ */
+void logError(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void logNotice(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void logDebug(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
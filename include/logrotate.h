@@ -0,0 +1,22 @@
+#ifndef LOGROTATE_H
+#define LOGROTATE_H
+
+#include <stddef.h>
+
+/* How often the rotation thread looks at the log when nothing wakes it */
+#define LOGROTATE_CHECK_MS 1000
+
+/*
+ * Rotation of the log file daemonize() put on stdout and stderr, run by a
+ * background thread. Once the file reaches max_bytes, or max_seconds after
+ * it was opened, it is renamed aside with a timestamp, a fresh file is
+ * opened at path and dup2()ed over both descriptors, and the old one is
+ * gzipped by a child process. dup2 swaps a descriptor atomically, so a
+ * writer never waits: each write lands whole in the old file or the new.
+ * There is one log per process, so this state is global.
+ */
+int logrotate_start(const char *path, size_t max_bytes, unsigned int max_seconds);
+void logrotate_reopen(void);
+void logrotate_stop(void);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef LOOPLAG_H
+#define LOOPLAG_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Pass durations in power of two buckets of microseconds, up to about 17 minutes */
+#define LAG_BUCKETS 31
+
+/* Where a pass of the relay loop spends its time */
+#define LAG_OTHER 0 /* Housekeeping, datagrams and dropping clients */
+#define LAG_POLL 1  /* Waiting in poll, not counted as busy */
+#define LAG_ACCEPT 2
+#define LAG_READ 3
+#define LAG_PARSE 4
+#define LAG_FANOUT 5 /* Relaying a frame, callbacks and control frames included */
+#define LAG_FLUSH 6  /* Draining queues and replays */
+#define LAG_BUSY 7   /* The whole pass but the wait */
+#define LAG_PHASES 8
+
+/*
+ * Loop lag instrumentation of one relay. The loop charges the time between
+ * phase changes to the phase it leaves and, at the end of each pass, adds
+ * every phase's share of it to that phase's histogram. While a pass is busy
+ * its start is published in busy_since, so a watchdog thread can flag one
+ * stuck beyond the threshold as it happens rather than after. Only the loop
+ * writes the histograms; readers may see a pass half added.
+ */
+struct LoopLag
+{
+    uint64_t threshold_ns;
+    uint64_t busy_since; /* 0 while the loop waits in poll */
+    int phase;
+    uint64_t mark; /* When the current phase began */
+    uint64_t pass_ns[LAG_PHASES];
+    uint64_t hist[LAG_PHASES][LAG_BUCKETS];
+    uint64_t passes;
+    uint64_t slow;   /* Passes busy beyond the threshold */
+    uint64_t stalls; /* Of those, the ones the watchdog caught while stuck */
+    uint64_t max_ns;
+    uint64_t flagged; /* busy_since of the pass last reported */
+    pthread_t watchdog;
+    volatile int running;
+};
+
+int lag_start(struct LoopLag *lag, uint64_t threshold_ns);
+void lag_stop(struct LoopLag *lag);
+void lag_begin(struct LoopLag *lag, uint64_t now);
+void lag_end(struct LoopLag *lag, uint64_t now);
+int lag_metrics(int fd, void *lag);
+
+/* Move the loop on to phase as of now, ending a wait or starting one */
+static inline void lag_phase(struct LoopLag *lag, int phase, uint64_t now)
+{
+    lag->pass_ns[lag->phase] += now - lag->mark;
+    lag->mark = now;
+    __atomic_store_n(&lag->phase, phase, __ATOMIC_RELAXED);
+    if (phase == LAG_POLL)
+        __atomic_store_n(&lag->busy_since, 0, __ATOMIC_RELEASE);
+    else if (__atomic_load_n(&lag->busy_since, __ATOMIC_RELAXED) == 0)
+        __atomic_store_n(&lag->busy_since, now, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef LVC_H
+#define LVC_H
+
+#include <stdint.h>
+
+#include "frame.h"
+
+/* Slots in the last-value cache, a power of two */
+#define LVC_CAPACITY 65536
+
+/*
+ * Last-value cache: the newest keyed frame per key, in an open addressing
+ * table. Keys live inside the cached frames, a slot only holds the key hash.
+ * In conflation mode a frame's payload starts with a one byte key length and
+ * the key; a key length of 0 marks an unkeyed frame.
+ */
+struct LvcSlot
+{
+    uint64_t hash;
+    struct Frame *value;
+};
+
+struct Lvc
+{
+    struct LvcSlot *slots;
+    uint32_t mask;
+    uint32_t count;
+};
+
+/*
+ * Keys a lagging client has missed updates for. Each key is queued at most
+ * once, so the set never grows beyond the cache's slot count.
+ */
+struct ConflateSet
+{
+    uint32_t *ring;
+    unsigned char *pending;
+    uint32_t head;
+    uint32_t count;
+};
+
+int lvc_init(struct Lvc *lvc, uint32_t capacity);
+int lvc_put(struct Lvc *lvc, struct Frame *frame);
+void lvc_free(struct Lvc *lvc);
+
+int conflate_mark(struct ConflateSet *set, struct Lvc *lvc, uint32_t slot);
+int conflate_snapshot(struct ConflateSet *set, struct Lvc *lvc);
+int conflate_pop(struct ConflateSet *set, struct Lvc *lvc);
+void conflate_clear(struct ConflateSet *set);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "zerocopy.h"
+#include "shm.h"
+#include "wire.h"
+
+/* Limits that bound what a slow consumer can hold */
+#define OUTQ_MAX_FRAMES 1024
+#define OUTQ_MAX_BYTES (4 * 1024 * 1024)
+/* Frames gathered into one sendmsg call */
+#define OUTQ_IOV 64
+
+/* Default byte limit of a coalescing window given only a duration */
+#define OUTQ_WINDOW_BYTES (64 * 1024)
+
+/* Outbound lanes, drained in this order */
+#define OUTQ_HIGH 0
+#define OUTQ_LOW 1
+#define OUTQ_LANES 2
+
+struct OutLane
+{
+    struct Frame **frames;
+    unsigned int head;
+    unsigned int count;
+};
+
+/*
+ * Frames waiting to be written to one connection, in a high and a low
+ * priority lane. High priority frames always leave first, except that a
+ * frame already partly on the wire is finished before anything else; offset
+ * is how much of the head of partial_lane was sent. since is when the oldest
+ * queued frame was added, blocked is set while the socket is full.
+ * Frames are stored in the 4-byte framing; with another wire format each
+ * gets its header written as it is sent, numbered by sequence, and offset
+ * and bytes count in that format.
+ */
+struct OutQueue
+{
+    struct OutLane lanes[OUTQ_LANES];
+    unsigned int count;
+    int partial_lane;
+    size_t offset;
+    size_t bytes;
+    uint64_t since;
+    int blocked;
+    int wire;          /* WIRE_LEGACY, WIRE_FIXED or WIRE_COMPACT */
+    uint64_t sequence; /* Of the next frame to leave completely */
+};
+
+/*
+ * Coalescing window: frames for a recipient are held until ns nanoseconds
+ * have passed since the oldest was queued or bytes are pending, then leave
+ * together in one gathered send. A zero window sends every frame at once.
+ */
+struct OutqWindow
+{
+    uint64_t ns;
+    size_t bytes;
+};
+
+int outq_push(struct OutQueue *queue, struct Frame *frame, size_t offset, int lane);
+int outq_flush(struct OutQueue *queue, int sockfd, struct ZeroCopy *zc, struct ShmRing *ring);
+void outq_clear(struct OutQueue *queue);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Flag bits carried in the high end of a frame's length word */
+#define FRAME_CONTROL 0x80000000u
+#define FRAME_PRIORITY 0x40000000u /* relayed ahead of queued bulk frames */
+#define FRAME_LENGTH_MASK 0x3fffffffu
+
+/* Receive buffer of one client, the largest frame is 4 bytes smaller */
+#define FRAME_BUFFER_SIZE (64 * 1024)
+
+/* A complete frame found in a receive buffer, payload not copied */
+struct FrameView
+{
+    const char *msg;
+    uint32_t len;
+    uint32_t flags;
+};
+
+int frame_parse(const char *buf, size_t avail, size_t max_len, struct FrameView *view);
+size_t frame_compact(char *buf, size_t pos, size_t consumed);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PEER_H
+#define PEER_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "frame.h"
+
+/* Peers one node dials */
+#define PEER_MAX 16
+/* Redial delay after a link fails, doubled per failure up to the maximum */
+#define PEER_RETRY_NS 100000000ull
+#define PEER_RETRY_MAX_NS 30000000000ull
+
+/* How a client connection takes part in the mesh */
+#define PEER_NONE 0
+#define PEER_DIALED 1   /* Opened by this node to a configured peer */
+#define PEER_ACCEPTED 2 /* Accepted, and turned into a link by the peer's hello */
+
+struct ClientConnection;
+
+/*
+ * Federation: nodes link as peers over ordinary relay connections that
+ * carry control frames only. A hello names the sending node, every data
+ * frame a node's own clients send goes to each linked node wrapped in a
+ * peer frame with its origin's node id, and a node relays peer frames to
+ * its own clients but never forwards them again. Nodes form a full mesh.
+ */
+struct PeerLink
+{
+    struct sockaddr_in addr;
+    struct ClientConnection *client; /* NULL while down */
+    uint64_t retry_at;
+    uint64_t backoff;
+};
+
+int peer_parse(struct PeerLink *link, const char *endpoint);
+int peer_dial(struct PeerLink *link);
+int peer_connected(int sockfd);
+void peer_retry(struct PeerLink *link, uint64_t now);
+struct Frame *peer_hello(uint64_t node_id);
+struct Frame *peer_wrap(const struct Frame *frame, uint64_t origin);
+
+#endif
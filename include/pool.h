@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* Blocks larger than this always come from malloc */
+#define POOL_MAX_BLOCK (256 * 1024)
+/* Four size classes per power of two from 64 bytes up to POOL_MAX_BLOCK */
+#define POOL_CLASSES 49
+/* Regions are rounded up to and aligned on this, the x86-64 huge page */
+#define POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+/* pool_new() flags */
+#define POOL_HUGETLB 1  /* Back with MAP_HUGETLB pages, falling back to POOL_THP */
+#define POOL_THP 2      /* Ask for transparent huge pages with madvise */
+#define POOL_PREFAULT 4 /* Touch every page up front */
+
+/*
+ * A per-relay allocator for frames and client connections. One region is
+ * mapped by the thread that drives the relay and bound to that thread's
+ * NUMA node, then carved into size-classed blocks with a free list per
+ * class. Not thread-safe: blocks must be returned on the owning thread.
+ * pool_alloc() falls back to malloc once the region is used up, and
+ * pool_release() tells the two apart, so callers need not care. A NULL
+ * pool means malloc throughout.
+ */
+struct Pool
+{
+    char *base;
+    size_t size;
+    size_t used; /* Bump pointer into the region, free lists first */
+    void *free[POOL_CLASSES];
+    size_t live; /* Blocks handed out, the region outlives pool_free() until 0 */
+    int dead;
+    int node;
+};
+
+struct Pool *pool_new(size_t size, int flags);
+void *pool_alloc(struct Pool *pool, size_t size);
+void pool_release(struct Pool *pool, void *block, size_t size);
+void pool_free(struct Pool *pool);
+
+#endif
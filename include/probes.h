@@ -0,0 +1,65 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes on the relay hot paths, compiled in with `make USDT=1`
+ * (needs <sys/sdt.h> from systemtap-sdt-dev). Each probe is guarded by a
+ * semaphore that tracers raise when they attach, so arguments such as
+ * timestamps are only computed while someone is listening, and a build
+ * without USDT has no probes at all.
+ *
+ *   accept(fd, ts)                      new client
+ *   frame(fd, len, flags, ts)           complete frame parsed
+ *   fanout_start(fd, len, ts)           relay of a frame begins
+ *   send(fd, len, sent)                 direct send to one recipient
+ *   flush(fd, result, queued_bytes)     queued frames written
+ *   fanout_end(fd, recipients, ts)      relay of a frame done
+ *   disconnect(fd, ts)                  client dropped
+ *
+ * Timestamps are CLOCK_MONOTONIC nanoseconds. For example:
+ *   bpftrace -e 'usdt:./daemonize:daemonize:fanout_end { @[arg1] = count(); }'
+ */
+
+#ifdef DAEMONIZE_USDT
+
+#include <stdint.h>
+#include <time.h>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) unsigned short daemonize_##name##_semaphore __attribute__((section(".probes")))
+#define PROBE_ENABLED(name) __builtin_expect(daemonize_##name##_semaphore != 0, 0)
+
+#define PROBE2(name, a, b) \
+    do { if (PROBE_ENABLED(name)) STAP_PROBE2(daemonize, name, a, b); } while (0)
+#define PROBE3(name, a, b, c) \
+    do { if (PROBE_ENABLED(name)) STAP_PROBE3(daemonize, name, a, b, c); } while (0)
+#define PROBE4(name, a, b, c, d) \
+    do { if (PROBE_ENABLED(name)) STAP_PROBE4(daemonize, name, a, b, c, d); } while (0)
+
+extern unsigned short daemonize_accept_semaphore;
+extern unsigned short daemonize_frame_semaphore;
+extern unsigned short daemonize_fanout_start_semaphore;
+extern unsigned short daemonize_send_semaphore;
+extern unsigned short daemonize_flush_semaphore;
+extern unsigned short daemonize_fanout_end_semaphore;
+extern unsigned short daemonize_disconnect_semaphore;
+
+static inline uint64_t probe_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#else
+
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+/* Burst a bucket allows, as milliseconds worth of its rate */
+#define RATE_BURST_MS 100
+
+/*
+ * Token bucket. Charges are taken after the fact and may leave the bucket in
+ * debt, so a frame larger than the burst still gets through, after which the
+ * client waits until the debt is paid off. A rate of 0 means unlimited.
+ */
+struct TokenBucket
+{
+    double rate;
+    double burst;
+    double tokens;
+    uint64_t last;
+};
+
+void bucket_init(struct TokenBucket *bucket, double rate, uint64_t now);
+int bucket_ready(struct TokenBucket *bucket, uint64_t now);
+void bucket_charge(struct TokenBucket *bucket, double amount);
+uint64_t bucket_wait(struct TokenBucket *bucket, uint64_t now);
+
+#endif
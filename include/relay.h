@@ -0,0 +1,97 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "outq.h"
+#include "udp.h"
+#include "peer.h"
+
+struct Relay;
+struct ClientConnection;
+struct Frame;
+
+/* Everything a relay instance is configured with, see relay_config_init() */
+struct RelayConfig
+{
+    int port;
+    int maxClients;
+    int udpPort;
+    const char *udpGroup;
+    const char *udpSubscribers[UDP_MAX_SUBSCRIBERS];
+    int udpSubscriberCount;
+    const char *journalDir;
+    const char *captureFile; /* Record every frame clients send here, for tools/replay */
+    int conflate;
+    struct OutqWindow window;
+    double rateFrames;
+    double rateBytes;
+    size_t zerocopyMin; /* Send frames this large with MSG_ZEROCOPY, 0 for never */
+    size_t spliceMin;   /* Pass frames this large through pipes, needs SIGPIPE ignored */
+    const char *tlsCert; /* PEM certificate chain, enables TLS with kernel offload */
+    const char *tlsKey;
+    size_t memLimit;       /* Bytes the relay may hold before shedding load, 0 for no limit */
+    size_t clientMemLimit; /* Bytes one client may pin, its 64KB receive buffer included */
+    uint64_t nodeId;             /* Non-zero to federate with other nodes under this id */
+    const char *peers[PEER_MAX]; /* host:port of the nodes this one links to */
+    int peerCount;
+    const char *unixPath; /* Unix socket for local clients talking through shared memory */
+    int busyPoll;       /* Microseconds to poll without blocking before poll sleeps, 0 to always sleep */
+    int busyPollSocket; /* SO_BUSY_POLL microseconds for the sockets, 0 to leave the kernel default */
+    size_t poolSize; /* Bytes of frame and connection pool on the loop thread's NUMA node, 0 for malloc */
+    int poolFlags;   /* POOL_HUGETLB, POOL_THP, POOL_PREFAULT */
+    int wire; /* Framing of every connection, WIRE_LEGACY unless WIRE_FIXED or WIRE_COMPACT; the shared memory handshake is always legacy */
+    int senderThreads; /* Threads that help send a frame to more than FANOUT_CHUNK clients, 0 for none */
+    int lagThreshold; /* Milliseconds a loop pass may stay busy before it is reported, 0 to not time the loop */
+};
+
+/*
+ * Optional callbacks into the embedding program, all run on the thread that
+ * drives the relay. on_frame sees every data frame a client sends and
+ * returns non-zero to have it relayed as usual, or 0 if it consumed it.
+ * on_drain runs once a client whose socket had filled up has been sent
+ * everything queued for it.
+ */
+struct RelayHandler
+{
+    void (*on_accept)(struct Relay *relay, struct ClientConnection *client, void *arg);
+    int (*on_frame)(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view, void *arg);
+    void (*on_close)(struct Relay *relay, struct ClientConnection *client, void *arg);
+    void (*on_drain)(struct Relay *relay, struct ClientConnection *client, void *arg);
+    void *arg;
+};
+
+void relay_config_init(struct RelayConfig *config);
+struct Relay *relay_new(const struct RelayConfig *config, const struct RelayHandler *handler);
+int relay_listen(struct Relay *relay);
+int relay_run_once(struct Relay *relay, int timeout_ms);
+int relay_run(struct Relay *relay);
+void relay_stop(struct Relay *relay);
+void relay_free(struct Relay *relay);
+
+/*
+ * relay_send queues a frame for one client only. relay_broadcast journals,
+ * caches and fans a frame out to every client but sender (NULL for none),
+ * exactly as if sender had written it. The _frame variants share an
+ * existing frame instead of copying msg. All return -1 if the frame could
+ * not be allocated or the client is closing; relay_send also if the frame
+ * was dropped to keep the relay or the client within its memory budget.
+ */
+int relay_send(struct Relay *relay, struct ClientConnection *client, const char *msg, uint32_t len, uint32_t flags);
+int relay_broadcast(struct Relay *relay, struct ClientConnection *sender, const char *msg, uint32_t len, uint32_t flags);
+int relay_send_frame(struct Relay *relay, struct ClientConnection *client, struct Frame *frame);
+int relay_broadcast_frame(struct Relay *relay, struct ClientConnection *sender, struct Frame *frame);
+void relay_close(struct Relay *relay, struct ClientConnection *client);
+
+/*
+ * The one call safe from any thread: queue frames to be broadcast by the
+ * loop thread as relay_broadcast_frame() with no sender would. Returns how
+ * many were taken, fewer once the inbox is full. Each taken frame's
+ * reference passes to the relay, so the caller must not touch it again;
+ * frames must come from frame_new() or frame_alloc(), not a relay's pool.
+ */
+unsigned int relay_post(struct Relay *relay, struct Frame *const *frames, unsigned int count);
+
+#endif
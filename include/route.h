@@ -0,0 +1,48 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdint.h>
+
+#include "frame.h"
+#include "parser.h"
+
+/* Initial slots in the client id index, a power of two */
+#define ROUTE_CAPACITY 64
+
+struct ClientConnection;
+
+struct RouteSlot
+{
+    uint64_t id; /* 0 for an empty slot */
+    struct ClientConnection *client;
+};
+
+/*
+ * Index of client ids, handed out in order from 1 at accept and never
+ * reused, so a stale id finds nothing instead of another client. Linear
+ * probing with backward shift deletion, doubled at half full.
+ *
+ * A client addresses another with a CTRL_ROUTE frame carrying the target's
+ * id and a correlation id of its own. The relay hands the target the same
+ * frame with the id replaced by the sender's, so a reply sent back with the
+ * header as received routes itself to the requester.
+ */
+struct RouteTable
+{
+    struct RouteSlot *slots;
+    uint32_t mask;
+    uint32_t count;
+    uint64_t next_id;
+};
+
+int route_init(struct RouteTable *table);
+uint64_t route_add(struct RouteTable *table, struct ClientConnection *client);
+struct ClientConnection *route_find(struct RouteTable *table, uint64_t id);
+void route_remove(struct RouteTable *table, uint64_t id);
+void route_free(struct RouteTable *table);
+
+struct Frame *route_forward(struct Pool *pool, const struct FrameView *view, uint64_t source);
+struct Frame *route_unreachable(struct Pool *pool, const struct FrameView *view);
+struct Frame *route_client_id(struct Pool *pool, uint64_t id);
+
+#endif
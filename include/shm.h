@@ -0,0 +1,69 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Bytes per ring direction unless the client asks otherwise, a power of two */
+#define SHM_RING_SIZE (1024 * 1024)
+#define SHM_RING_MIN (64 * 1024)
+#define SHM_RING_MAX (64 * 1024 * 1024)
+/* Header page at the start of the mapping, one ring header per direction */
+#define SHM_HEADER_SIZE 4096
+
+/*
+ * Shared state of one single-producer single-consumer byte ring. head and
+ * tail count bytes ever consumed and produced, each written by one side
+ * only and kept on its own cache line. A side about to sleep raises its
+ * flag and checks the ring once more; the other side kicks its eventfd
+ * only while the flag is up, so a busy pair never makes a syscall.
+ */
+struct ShmRingHeader
+{
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t consumer_idle;
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t producer_waiting;
+};
+
+/* One side's view of a ring; kick is the eventfd the other side sleeps on */
+struct ShmRing
+{
+    struct ShmRingHeader *header;
+    char *data;
+    size_t size;
+    int kick;
+};
+
+/*
+ * A client's shared memory transport: a memfd mapping with a ring per
+ * direction, and an eventfd each side sleeps on. The client's frames come
+ * in through in and its deliveries go out through out, in the same wire
+ * format as on a socket; the socket it was negotiated over stays open to
+ * tell either side of a hangup.
+ */
+struct ShmChannel
+{
+    void *base;
+    size_t map_size;
+    struct ShmRing in;
+    struct ShmRing out;
+    int efd;      /* This side sleeps on it */
+    int peer_efd; /* The other side sleeps on it */
+};
+
+void shm_init(struct ShmChannel *channel);
+int shm_offer(struct ShmChannel *channel, int sockfd, uint64_t size);
+int shm_open_client(struct ShmChannel *channel, int sockfd, uint64_t size);
+void shm_close(struct ShmChannel *channel);
+
+size_t shm_put(struct ShmRing *ring, const void *data, size_t len);
+size_t shm_putv(struct ShmRing *ring, const struct iovec *iov, int count);
+size_t shm_get(struct ShmRing *ring, void *buf, size_t len);
+size_t shm_used(const struct ShmRing *ring);
+int shm_consumer_sleep(struct ShmRing *ring);
+int shm_producer_sleep(struct ShmRing *ring);
+void shm_wake(struct ShmChannel *channel, int kicked);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SPLICE_H
+#define SPLICE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Pipe capacity asked for, room for a whole frame in small segments */
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+/*
+ * A pipe carrying frame bytes between sockets inside the kernel. splice()
+ * moves page references into and out of it and tee() duplicates them into
+ * a second pipe, so a payload is never copied through userspace. bytes is
+ * how much the pipe currently holds.
+ */
+struct SplicePipe
+{
+    int rd;
+    int wr;
+    size_t bytes;
+};
+
+void splice_pipe_init(struct SplicePipe *pipe);
+int splice_pipe_open(struct SplicePipe *pipe);
+void splice_pipe_close(struct SplicePipe *pipe);
+ssize_t splice_in(struct SplicePipe *pipe, int sockfd, size_t len);
+int splice_put(struct SplicePipe *pipe, const char *data, size_t len);
+int splice_tee(struct SplicePipe *from, struct SplicePipe *to, size_t len);
+int splice_move(struct SplicePipe *from, struct SplicePipe *to, size_t len);
+int splice_read(struct SplicePipe *pipe, char *data, size_t len);
+int splice_out(struct SplicePipe *pipe, int sockfd);
+
+#endif
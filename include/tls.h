@@ -0,0 +1,25 @@
+#ifndef TLS_H
+#define TLS_H
+
+/* What a handshake in progress is waiting for */
+#define TLS_WANT_READ 1
+#define TLS_WANT_WRITE 2
+
+struct ssl_ctx_st;
+struct ssl_st;
+
+/*
+ * TLS on the relay's listener, built with `make TLS=1` (OpenSSL 3). Only
+ * the handshake runs in userspace: once it is done the session keys are
+ * handed to kernel TLS in both directions, so every other path (send,
+ * sendmsg, sendfile, splice) keeps writing plain frames to the socket and
+ * the kernel encrypts them. A client for which kTLS cannot be enabled is
+ * refused rather than served through OpenSSL.
+ */
+struct ssl_ctx_st *tls_server_new(const char *cert, const char *key);
+struct ssl_st *tls_session_new(struct ssl_ctx_st *ctx, int sockfd);
+int tls_handshake(struct ssl_st *ssl);
+void tls_session_free(struct ssl_st *ssl, int established);
+void tls_server_free(struct ssl_ctx_st *ctx);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Datagrams moved per recvmmsg/sendmmsg call */
+#define UDP_BATCH 64
+/* Largest frame carried in a single datagram */
+#define UDP_MAX_DATAGRAM 1472
+#define UDP_MAX_SUBSCRIBERS 32
+/* Largest datagram count the kernel accepts in one UDP_SEGMENT send */
+#define UDP_MAX_GSO_SEGMENTS 64
+
+/*
+ * Datagram relay: every datagram received on sock is one frame and is
+ * re-published unchanged to each subscriber endpoint (unicast or a
+ * multicast group).
+ */
+struct UdpRelay
+{
+    int sock;
+    int gso;
+    struct sockaddr_in subscribers[UDP_MAX_SUBSCRIBERS];
+    int subscriber_count;
+
+    /* Receive side, one slot per datagram */
+    struct mmsghdr rx_msgs[UDP_BATCH];
+    struct iovec rx_iov[UDP_BATCH];
+    char rx_buf[UDP_BATCH][UDP_MAX_DATAGRAM];
+
+    /* Send side, one message per (run of datagrams, subscriber) */
+    struct mmsghdr tx_msgs[UDP_BATCH * UDP_MAX_SUBSCRIBERS];
+    struct iovec tx_iov[UDP_BATCH];
+    char tx_cmsg[UDP_BATCH][CMSG_SPACE(sizeof(unsigned short))];
+    char gso_buf[UDP_BATCH * UDP_MAX_DATAGRAM];
+};
+
+int udp_open(struct UdpRelay *udp, int port, const char *group);
+int udp_add_subscriber(struct UdpRelay *udp, const char *endpoint);
+int udp_relay_batch(struct UdpRelay *udp);
+void udp_close(struct UdpRelay *udp);
+
+#endif
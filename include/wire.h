@@ -0,0 +1,190 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include "parser.h"
+
+/* Framings a relay can speak, see RelayConfig.wire */
+#define WIRE_LEGACY 0  /* 4-byte big-endian length word carrying the flags */
+#define WIRE_FIXED 1   /* Versioned header laid out by WIRE_FIXED_FIELDS */
+#define WIRE_COMPACT 2 /* Tag byte laid out by WIRE_COMPACT_FIELDS, then a prefix varint length */
+
+#define WIRE_VERSION_FIXED 1
+#define WIRE_VERSION_COMPACT 2
+
+/* Header field values */
+#define WIRE_TYPE_DATA 0
+#define WIRE_TYPE_CONTROL 1
+#define WIRE_FLAG_PRIORITY 1
+
+/* Bytes of the longest header any framing writes */
+#define WIRE_MAX_HEADER 20
+
+/*
+ * Header layouts are lists of (field, bytes), every field big-endian. Adding
+ * a version means adding a list: WIRE_LAYOUT turns each one into a struct of
+ * byte arrays, whose offsetof() and sizeof() place every field at compile
+ * time, and into an encoder and decoder unrolled for exactly those offsets
+ * and widths. Decoding a header is then straight-line loads and byte swaps,
+ * with no branch on the layout.
+ */
+#define WIRE_FIXED_FIELDS(X) \
+    X(version, 1)            \
+    X(type, 1)               \
+    X(flags, 2)              \
+    X(length, 4)             \
+    X(channel, 4)            \
+    X(sequence, 8)
+
+/* tag is the version in the high nibble, type in bit 1 and priority in bit 0 */
+#define WIRE_COMPACT_FIELDS(X) \
+    X(tag, 1)
+
+/* bytes is a constant at every call, so only one case survives inlining */
+static inline uint64_t wire_load(const unsigned char *p, int bytes)
+{
+    uint64_t value = 0;
+    uint32_t v32;
+    uint16_t v16;
+    int i;
+
+    switch (bytes)
+    {
+    case 1:
+        return p[0];
+    case 2:
+        memcpy(&v16, p, 2);
+        return be16toh(v16);
+    case 4:
+        memcpy(&v32, p, 4);
+        return be32toh(v32);
+    case 8:
+        memcpy(&value, p, 8);
+        return be64toh(value);
+    default:
+        for (i = 0; i < bytes; i++)
+            value = (value << 8) | p[i];
+        return value;
+    }
+}
+
+static inline void wire_store(unsigned char *p, uint64_t value, int bytes)
+{
+    uint32_t v32;
+    uint16_t v16;
+    int i;
+
+    switch (bytes)
+    {
+    case 1:
+        p[0] = value;
+        break;
+    case 2:
+        v16 = htobe16(value);
+        memcpy(p, &v16, 2);
+        break;
+    case 4:
+        v32 = htobe32(value);
+        memcpy(p, &v32, 4);
+        break;
+    case 8:
+        value = htobe64(value);
+        memcpy(p, &value, 8);
+        break;
+    default:
+        for (i = bytes - 1; i >= 0; i--)
+        {
+            p[i] = value;
+            value >>= 8;
+        }
+        break;
+    }
+}
+
+#define WIRE_LAYOUT_FIELD(field, bytes) unsigned char field[bytes];
+#define WIRE_HEADER_FIELD(field, bytes) uint64_t field;
+#define WIRE_ENCODE_FIELD(field, bytes) wire_store(p + offsetof(wire_layout, field), header->field, bytes);
+#define WIRE_DECODE_FIELD(field, bytes) header->field = wire_load(p + offsetof(wire_layout, field), bytes);
+
+#define WIRE_LAYOUT(Name, prefix, FIELDS)                                                  \
+    struct Name##Layout                                                                    \
+    {                                                                                      \
+        FIELDS(WIRE_LAYOUT_FIELD)                                                          \
+    };                                                                                     \
+    struct Name##Header                                                                    \
+    {                                                                                      \
+        FIELDS(WIRE_HEADER_FIELD)                                                          \
+    };                                                                                     \
+    static inline void prefix##_encode(unsigned char *p, const struct Name##Header *header) \
+    {                                                                                      \
+        typedef struct Name##Layout wire_layout;                                           \
+        FIELDS(WIRE_ENCODE_FIELD)                                                          \
+    }                                                                                      \
+    static inline void prefix##_decode(const unsigned char *p, struct Name##Header *header) \
+    {                                                                                      \
+        typedef struct Name##Layout wire_layout;                                           \
+        FIELDS(WIRE_DECODE_FIELD)                                                          \
+    }
+
+WIRE_LAYOUT(WireFixed, wire_fixed, WIRE_FIXED_FIELDS)
+WIRE_LAYOUT(WireCompact, wire_compact, WIRE_COMPACT_FIELDS)
+
+#define WIRE_FIXED_SIZE sizeof(struct WireFixedLayout)
+#define WIRE_COMPACT_SIZE sizeof(struct WireCompactLayout)
+
+/*
+ * Prefix varints: the count of trailing zero bits in the first byte, plus
+ * one, is the length in bytes, and the value is the little-endian rest. A
+ * frame length takes at most five bytes.
+ */
+#define WIRE_VARINT_MAX 5
+
+static inline int wire_varint_size(uint64_t value)
+{
+    return value < (1ull << 7) ? 1 : (64 - __builtin_clzll(value) + 6) / 7;
+}
+
+static inline int wire_varint_encode(unsigned char *p, uint64_t value)
+{
+    int n = wire_varint_size(value);
+    uint64_t word = (value << n) | (1ull << (n - 1));
+    int i;
+
+    for (i = 0; i < n; i++)
+        p[i] = word >> (8 * i);
+    return n;
+}
+
+/* Decode from 8 readable bytes, returns the varint's size or -1 if too long */
+static inline int wire_varint_decode(const unsigned char *p, uint64_t *value)
+{
+    int n = __builtin_ctz(p[0] | 0x100) + 1;
+    int bytes = n < WIRE_VARINT_MAX ? n : WIRE_VARINT_MAX;
+    uint64_t word;
+
+    memcpy(&word, p, sizeof(word));
+    *value = (le64toh(word) & ((1ull << (8 * bytes)) - 1)) >> n;
+    return n <= WIRE_VARINT_MAX ? n : -1;
+}
+
+static inline size_t wire_header_size(int format, uint32_t len)
+{
+    switch (format)
+    {
+    case WIRE_FIXED:
+        return WIRE_FIXED_SIZE;
+    case WIRE_COMPACT:
+        return WIRE_COMPACT_SIZE + wire_varint_size(len);
+    default:
+        return 4;
+    }
+}
+
+int wire_parse(int format, const char *buf, size_t avail, size_t size, struct FrameView *view);
+size_t wire_header(int format, unsigned char *header, uint32_t len, uint32_t flags, uint64_t sequence);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "frame.h"
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/* Frame references one socket may hold for unfinished zero-copy sends */
+#define ZC_MAX_PENDING 256
+
+struct ZcEntry
+{
+    uint32_t id;
+    int done;
+    struct Frame *frame;
+};
+
+/*
+ * MSG_ZEROCOPY state of one socket. The kernel numbers zero-copy sends from
+ * 0 and reports finished ranges of them on the socket's error queue; until
+ * then the pages of the frames sent are still in use, so each frame keeps a
+ * reference here tagged with the number of its send. min is the smallest
+ * send worth pinning pages for, 0 once zero copy is off for the socket.
+ */
+struct ZeroCopy
+{
+    struct ZcEntry *pending;
+    unsigned int head;
+    unsigned int count;
+    uint32_t next_id;
+    size_t min;
+};
+
+int zc_enable(struct ZeroCopy *zc, int sockfd, size_t min);
+int zc_want(const struct ZeroCopy *zc, size_t bytes, unsigned int frames);
+void zc_track(struct ZeroCopy *zc, struct Frame *const *frames, unsigned int count);
+int zc_reap(struct ZeroCopy *zc, int sockfd);
+void zc_clear(struct ZeroCopy *zc);
+
+#endif
@@ -0,0 +1,178 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "admin.h"
+#include "flightrec.h"
+
+static struct
+{
+    char path[108];
+    int sock;
+    pthread_t thread;
+    volatile int running;
+} admin = {"", -1, 0, 0};
+
+/* Held while a provider writes, so one being removed is never called after */
+static pthread_mutex_t providers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    int (*metrics)(int fd, void *arg);
+    void *arg;
+} providers[ADMIN_MAX_METRICS];
+static int provider_count;
+
+static void write_metrics(int fd)
+{
+    int i;
+
+    flightrec_metrics(fd);
+    pthread_mutex_lock(&providers_lock);
+    for (i = 0; i < provider_count; i++)
+    {
+        if (providers[i].metrics(fd, providers[i].arg) != 0)
+            break;
+    }
+    pthread_mutex_unlock(&providers_lock);
+}
+
+/* Read one command line and answer it */
+static void serve(int fd)
+{
+    struct timeval timeout = {ADMIN_TIMEOUT_MS / 1000, ADMIN_TIMEOUT_MS % 1000 * 1000};
+    char command[64];
+    size_t len = 0;
+    ssize_t n;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (len < sizeof(command) - 1 && memchr(command, '\n', len) == NULL)
+    {
+        n = read(fd, command + len, sizeof(command) - 1 - len);
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    while (len > 0 && (command[len - 1] == '\n' || command[len - 1] == '\r'))
+        len--;
+    command[len] = '\0';
+
+    if (strcmp(command, "flightrec") == 0)
+        flightrec_dump(fd);
+    else if (strcmp(command, "metrics") == 0)
+        write_metrics(fd);
+    else if (write(fd, "unknown command\n", 16) < 0)
+        syslog(LOG_ERR, "admin write failed: %s (%d)\n", strerror(errno), errno);
+}
+
+static void *admin_thread(void *arg)
+{
+    int fd;
+
+    (void)arg;
+    while (admin.running)
+    {
+        fd = accept(admin.sock, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            /* admin_stop() shut the socket down */
+            break;
+        }
+        serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Listen on path, replacing a stale socket, and serve it from a thread */
+int admin_start(const char *path)
+{
+    struct sockaddr_un addr;
+    int error;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        syslog(LOG_ERR, "admin socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(admin.path, path);
+    unlink(path);
+
+    admin.sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (admin.sock == -1 || bind(admin.sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(admin.sock, 8) == -1)
+    {
+        syslog(LOG_ERR, "admin socket failed: %s (%d)\n", strerror(errno), errno);
+        admin_stop();
+        return -1;
+    }
+    admin.running = 1;
+    error = pthread_create(&admin.thread, NULL, admin_thread, NULL);
+    if (error != 0)
+    {
+        syslog(LOG_ERR, "pthread_create failed: %s (%d)\n", strerror(error), error);
+        admin.running = 0;
+        admin_stop();
+        return -1;
+    }
+    return 0;
+}
+
+void admin_stop(void)
+{
+    if (admin.running)
+    {
+        admin.running = 0;
+        shutdown(admin.sock, SHUT_RDWR);
+        pthread_join(admin.thread, NULL);
+    }
+    if (admin.sock >= 0)
+    {
+        close(admin.sock);
+        unlink(admin.path);
+        admin.sock = -1;
+    }
+}
+
+int admin_add_metrics(int (*metrics)(int fd, void *arg), void *arg)
+{
+    int result = -1;
+
+    pthread_mutex_lock(&providers_lock);
+    if (provider_count < ADMIN_MAX_METRICS)
+    {
+        providers[provider_count].metrics = metrics;
+        providers[provider_count].arg = arg;
+        provider_count++;
+        result = 0;
+    }
+    pthread_mutex_unlock(&providers_lock);
+    if (result != 0)
+        syslog(LOG_ERR, "too many metrics providers\n");
+    return result;
+}
+
+void admin_remove_metrics(int (*metrics)(int fd, void *arg), void *arg)
+{
+    int i;
+
+    pthread_mutex_lock(&providers_lock);
+    for (i = 0; i < provider_count; i++)
+    {
+        if (providers[i].metrics == metrics && providers[i].arg == arg)
+        {
+            providers[i] = providers[--provider_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&providers_lock);
+}
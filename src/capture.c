@@ -0,0 +1,94 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "capture.h"
+#include "wire.h"
+
+/* Varint, varint, length word */
+#define RECORD_HEADER_MAX (2 * WIRE_VARINT_MAX + 4)
+
+/* Start a capture at path, now being the relay's monotonic clock */
+int capture_open(struct Capture *capture, const char *path, uint64_t now)
+{
+    struct timespec ts;
+
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fd == -1)
+    {
+        syslog(LOG_ERR, "capture open failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memcpy(capture->buffer, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+    wire_store((unsigned char *)capture->buffer + CAPTURE_MAGIC_SIZE, (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec, 8);
+    capture->pos = CAPTURE_MAGIC_SIZE + 8;
+    capture->last_ns = now;
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        written = write(fd, buf, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+int capture_flush(struct Capture *capture)
+{
+    if (capture->pos > 0 && write_all(capture->fd, capture->buffer, capture->pos) != 0)
+    {
+        syslog(LOG_ERR, "capture write failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    capture->pos = 0;
+    return 0;
+}
+
+/* Record a frame client_id sent; frames larger than the buffer bypass it */
+int capture_frame(struct Capture *capture, uint64_t client_id, uint64_t now, const struct FrameView *view)
+{
+    uint64_t gap = now > capture->last_ns ? now - capture->last_ns : 0;
+    unsigned char *p;
+
+    if (capture->pos + RECORD_HEADER_MAX + view->len > sizeof(capture->buffer) && capture_flush(capture) != 0)
+        return -1;
+    p = (unsigned char *)capture->buffer + capture->pos;
+    p += wire_varint_encode(p, gap < CAPTURE_MAX_GAP_NS ? gap : CAPTURE_MAX_GAP_NS);
+    p += wire_varint_encode(p, client_id);
+    wire_store(p, view->len | view->flags, 4);
+    p += 4;
+    capture->last_ns += gap;
+    capture->pos = (char *)p - capture->buffer;
+
+    if (capture->pos + view->len > sizeof(capture->buffer))
+    {
+        if (capture_flush(capture) != 0 || write_all(capture->fd, view->msg, view->len) != 0)
+            return -1;
+        return 0;
+    }
+    memcpy(capture->buffer + capture->pos, view->msg, view->len);
+    capture->pos += view->len;
+    return 0;
+}
+
+void capture_close(struct Capture *capture)
+{
+    capture_flush(capture);
+    close(capture->fd);
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "config.h"
+#include "log.h"
+
+static const char *const priorities[] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
+
+/* Strip leading and trailing blanks in place */
+static char *trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+static int parse_int(const char *value, int min, int max, int *out)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || n < min || n > max)
+        return -1;
+    *out = (int)n;
+    return 0;
+}
+
+static int parse_priority(const char *value, int *out)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(priorities) / sizeof(priorities[0])); i++)
+    {
+        if (strcasecmp(value, priorities[i]) == 0)
+        {
+            *out = i;
+            return 0;
+        }
+    }
+    return parse_int(value, LOG_EMERG, LOG_DEBUG, out);
+}
+
+static int parse_string(const char *value, char **out)
+{
+    free(*out);
+    *out = strdup(value);
+    return *out == NULL ? -1 : 0;
+}
+
+int readConfig(const char *file, const char *name, int *port, int *maxClients, int *logLevel, char **logFile,
+               char **tlsCert, char **tlsKey)
+{
+    char line[512];
+    char *key;
+    char *value;
+    char *end;
+    FILE *f;
+    int in_section = 0;
+    int found = 0;
+    int lineno = 0;
+    int result = 0;
+
+    f = fopen(file, "r");
+    if (f == NULL)
+    {
+        logError("Failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+
+    while (result == 0 && fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+        key = trim(line);
+        if (*key == '\0' || *key == '#' || *key == ';')
+            continue;
+
+        /* Section header */
+        if (*key == '[')
+        {
+            end = strchr(key, ']');
+            if (end == NULL)
+            {
+                logError("%s:%d: unterminated section", file, lineno);
+                result = -1;
+                break;
+            }
+            *end = '\0';
+            in_section = strcmp(trim(key + 1), name) == 0;
+            found |= in_section;
+            continue;
+        }
+        if (!in_section)
+            continue;
+
+        value = strchr(key, '=');
+        if (value == NULL)
+        {
+            logError("%s:%d: expected key = value", file, lineno);
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+        key = trim(key);
+        value = trim(value);
+
+        if (strcmp(key, "port") == 0)
+            result = parse_int(value, 0, 65535, port);
+        else if (strcmp(key, "maxClients") == 0)
+            result = parse_int(value, 1, 1000000, maxClients);
+        else if (strcmp(key, "logLevel") == 0)
+            result = parse_priority(value, logLevel);
+        else if (strcmp(key, "logFile") == 0)
+            result = parse_string(value, logFile);
+        else if (strcmp(key, "tlsCert") == 0)
+            result = parse_string(value, tlsCert);
+        else if (strcmp(key, "tlsKey") == 0)
+            result = parse_string(value, tlsKey);
+        if (result != 0)
+            logError("%s:%d: bad value for %s", file, lineno, key);
+    }
+    fclose(f);
+
+    if (result == 0 && !found)
+    {
+        logError("%s: no section [%s]", file, name);
+        result = -1;
+    }
+    return result;
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+#include <syslog.h>
+
+#include "fanout.h"
+
+/* Claim chunks until the job has none left */
+static void work(struct Fanout *fanout)
+{
+    size_t begin;
+    size_t end;
+
+    for (;;)
+    {
+        begin = __atomic_fetch_add(&fanout->next, FANOUT_CHUNK, __ATOMIC_RELAXED);
+        if (begin >= fanout->items)
+            return;
+        end = begin + FANOUT_CHUNK < fanout->items ? begin + FANOUT_CHUNK : fanout->items;
+        fanout->work(fanout->arg, begin, end);
+    }
+}
+
+/*
+ * A worker only joins a job still open when it wakes up. The poster closes
+ * the job once it finds no chunk left to claim, so it then has only to wait
+ * for the workers that joined, never for one that was slow to wake.
+ */
+static void *worker(void *arg)
+{
+    struct Fanout *fanout = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&fanout->lock);
+    for (;;)
+    {
+        while (!fanout->stop && fanout->job == seen)
+            pthread_cond_wait(&fanout->wake, &fanout->lock);
+        if (fanout->stop)
+            break;
+        seen = fanout->job;
+        if (!fanout->open)
+            continue;
+        fanout->joined++;
+        pthread_mutex_unlock(&fanout->lock);
+
+        work(fanout);
+
+        pthread_mutex_lock(&fanout->lock);
+        if (--fanout->joined == 0)
+            pthread_cond_signal(&fanout->done);
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    return NULL;
+}
+
+int fanout_start(struct Fanout *fanout, int threads)
+{
+    int error;
+
+    memset(fanout, 0, sizeof(*fanout));
+    pthread_mutex_init(&fanout->lock, NULL);
+    pthread_cond_init(&fanout->wake, NULL);
+    pthread_cond_init(&fanout->done, NULL);
+    if (threads > FANOUT_MAX_THREADS)
+        threads = FANOUT_MAX_THREADS;
+    for (fanout->count = 0; fanout->count < threads; fanout->count++)
+    {
+        error = pthread_create(&fanout->threads[fanout->count], NULL, worker, fanout);
+        if (error != 0)
+        {
+            syslog(LOG_ERR, "pthread_create failed: %s (%d)\n", strerror(error), error);
+            fanout_stop(fanout);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Run work over items on the workers and this thread, returning when all are done */
+void fanout_run(struct Fanout *fanout, size_t items, void (*work_fn)(void *arg, size_t begin, size_t end), void *arg)
+{
+    pthread_mutex_lock(&fanout->lock);
+    fanout->work = work_fn;
+    fanout->arg = arg;
+    fanout->items = items;
+    fanout->next = 0;
+    fanout->open = 1;
+    fanout->job++;
+    pthread_cond_broadcast(&fanout->wake);
+    pthread_mutex_unlock(&fanout->lock);
+
+    work(fanout);
+
+    pthread_mutex_lock(&fanout->lock);
+    fanout->open = 0;
+    while (fanout->joined > 0)
+        pthread_cond_wait(&fanout->done, &fanout->lock);
+    pthread_mutex_unlock(&fanout->lock);
+}
+
+void fanout_stop(struct Fanout *fanout)
+{
+    int i;
+
+    pthread_mutex_lock(&fanout->lock);
+    fanout->stop = 1;
+    pthread_cond_broadcast(&fanout->wake);
+    pthread_mutex_unlock(&fanout->lock);
+    for (i = 0; i < fanout->count; i++)
+        pthread_join(fanout->threads[i], NULL);
+    pthread_mutex_destroy(&fanout->lock);
+    pthread_cond_destroy(&fanout->wake);
+    pthread_cond_destroy(&fanout->done);
+}
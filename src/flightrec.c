@@ -0,0 +1,169 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <syslog.h>
+
+#include "flightrec.h"
+
+struct FlightRecorder flightrec;
+
+static const char *const type_names[FR_TYPES] = {"accept", "frame", "send", "flush", "disconnect", "error"};
+
+/* Where fatal signals, SIGUSR1 and failed exits dump the recorder */
+static char dump_path[4096];
+
+/* Append a decimal number, snprintf is not async-signal-safe */
+static char *put_number(char *out, int64_t value)
+{
+    char digits[24];
+    uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    if (value < 0)
+        *out++ = '-';
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+static char *put_string(char *out, const char *s)
+{
+    while (*s != '\0')
+        *out++ = *s++;
+    return out;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Write every event still in the ring to fd, oldest first, one per line */
+int flightrec_dump(int fd)
+{
+    struct FlightEvent *slot;
+    struct FlightEvent event;
+    char line[160];
+    char *out;
+    uint64_t end = __atomic_load_n(&flightrec.next, __ATOMIC_ACQUIRE);
+    uint64_t seq = end > FLIGHTREC_EVENTS ? end - FLIGHTREC_EVENTS : 0;
+
+    for (; seq < end; seq++)
+    {
+        slot = &flightrec.events[seq & (FLIGHTREC_EVENTS - 1)];
+        event.seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        event.time_ns = __atomic_load_n(&slot->time_ns, __ATOMIC_RELAXED);
+        event.type = __atomic_load_n(&slot->type, __ATOMIC_RELAXED);
+        event.fd = __atomic_load_n(&slot->fd, __ATOMIC_RELAXED);
+        event.a = __atomic_load_n(&slot->a, __ATOMIC_RELAXED);
+        event.b = __atomic_load_n(&slot->b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        /* Skip a slot being written or already reused */
+        if (event.seq != seq + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq + 1 || event.type >= FR_TYPES)
+            continue;
+
+        out = put_number(line, seq);
+        *out++ = ' ';
+        out = put_number(out, event.time_ns);
+        *out++ = ' ';
+        out = put_string(out, type_names[event.type]);
+        out = put_string(out, " fd=");
+        out = put_number(out, event.fd);
+        out = put_string(out, " a=");
+        out = put_number(out, event.a);
+        out = put_string(out, " b=");
+        out = put_number(out, event.b);
+        *out++ = '\n';
+        if (write_all(fd, line, out - line) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int flightrec_dump_file(const char *path)
+{
+    int result;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    result = flightrec_dump(fd);
+    close(fd);
+    return result;
+}
+
+/* Write how many events of each type were ever recorded */
+int flightrec_metrics(int fd)
+{
+    char buf[FR_TYPES * 48 + 48];
+    char *out = buf;
+    int i;
+
+    out = put_string(out, "events ");
+    out = put_number(out, __atomic_load_n(&flightrec.next, __ATOMIC_RELAXED));
+    *out++ = '\n';
+    for (i = 0; i < FR_TYPES; i++)
+    {
+        out = put_string(out, type_names[i]);
+        *out++ = ' ';
+        out = put_number(out, __atomic_load_n(&flightrec.counts[i], __ATOMIC_RELAXED));
+        *out++ = '\n';
+    }
+    return write_all(fd, buf, out - buf);
+}
+
+static void dump_signal(int signo)
+{
+    flightrec_dump_file(dump_path);
+    if (signo == SIGUSR1)
+        return;
+    /* Die of the original signal, now with the default action */
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+static void dump_exit(int status, void *arg)
+{
+    (void)arg;
+    if (status != 0)
+        flightrec_dump_file(dump_path);
+}
+
+/*
+ * Dump the recorder to path on SIGUSR1, on a crash and on any exit with a
+ * non-zero status.
+ */
+int flightrec_install(const char *path)
+{
+    static const int fatal[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    unsigned int i;
+
+    if (strlen(path) >= sizeof(dump_path))
+    {
+        syslog(LOG_ERR, "flight recorder path too long\n");
+        return -1;
+    }
+    strcpy(dump_path, path);
+    signal(SIGUSR1, dump_signal);
+    for (i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++)
+        signal(fatal[i], dump_signal);
+    return on_exit(dump_exit, NULL);
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "fqueue.h"
+
+/* size must be a power of two */
+int fq_init(struct FrameQueue *queue, uint64_t size, int flags)
+{
+    uint64_t i;
+
+    memset(queue, 0, sizeof(*queue));
+    if (size < 2 || (size & (size - 1)) != 0)
+    {
+        syslog(LOG_ERR, "frame queue size %llu is not a power of two\n", (unsigned long long)size);
+        return -1;
+    }
+    queue->cells = malloc(size * sizeof(struct FqCell));
+    if (queue->cells == NULL)
+    {
+        syslog(LOG_ERR, "malloc failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    for (i = 0; i < size; i++)
+    {
+        queue->cells[i].seq = i;
+        queue->cells[i].frame = NULL;
+    }
+    queue->mask = size - 1;
+    queue->flags = flags;
+    return 0;
+}
+
+void fq_free(struct FrameQueue *queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+/*
+ * Claim up to count cells, count > 0, from the position in index that are
+ * in state pos + ready: free ones to fill (0) or full ones to drain (1). A
+ * side with one thread on it just moves its index on. Returns how many were
+ * claimed, from *start, or 0 if the queue is full or empty respectively.
+ */
+static unsigned int claim(struct FrameQueue *queue, uint64_t *index, uint64_t ready, int single, unsigned int count,
+                          uint64_t *start)
+{
+    uint64_t pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+    int64_t diff;
+    unsigned int n;
+
+    for (;;)
+    {
+        diff = 0;
+        for (n = 0; n < count; n++)
+        {
+            diff = (int64_t)(__atomic_load_n(&queue->cells[(pos + n) & queue->mask].seq, __ATOMIC_ACQUIRE) - (pos + n + ready));
+            if (diff != 0)
+                break;
+        }
+        if (n == 0 && diff < 0)
+            return 0;
+        if (n == 0)
+        {
+            /* Another thread took this position, catch up */
+            pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (single)
+        {
+            __atomic_store_n(index, pos + n, __ATOMIC_RELAXED);
+            break;
+        }
+        if (__atomic_compare_exchange_n(index, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    *start = pos;
+    return n;
+}
+
+/* Append up to count frames, in order; returns how many fit */
+unsigned int fq_push(struct FrameQueue *queue, struct Frame *const *frames, unsigned int count)
+{
+    struct FqCell *cell;
+    uint64_t pos;
+    unsigned int n;
+    unsigned int i;
+
+    /* claim() would take an empty run for a taken position and spin */
+    if (count == 0)
+        return 0;
+    n = claim(queue, &queue->head, 0, queue->flags & FQ_SINGLE_PRODUCER, count, &pos);
+    for (i = 0; i < n; i++)
+    {
+        cell = &queue->cells[(pos + i) & queue->mask];
+        cell->frame = frames[i];
+        __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+/* Take up to count frames, oldest first; returns how many there were */
+unsigned int fq_pop(struct FrameQueue *queue, struct Frame **frames, unsigned int count)
+{
+    struct FqCell *cell;
+    uint64_t pos;
+    unsigned int n;
+    unsigned int i;
+
+    if (count == 0)
+        return 0;
+    n = claim(queue, &queue->tail, 1, queue->flags & FQ_SINGLE_CONSUMER, count, &pos);
+    for (i = 0; i < n; i++)
+    {
+        cell = &queue->cells[(pos + i) & queue->mask];
+        frames[i] = cell->frame;
+        __atomic_store_n(&cell->seq, pos + i + queue->mask + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+/* Whether the next frame to drain is still missing, as of now */
+int fq_empty(struct FrameQueue *queue)
+{
+    uint64_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&queue->cells[pos & queue->mask].seq, __ATOMIC_ACQUIRE) != pos + 1;
+}
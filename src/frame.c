@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+/* A frame with the length word set and msg_len bytes of payload to fill in */
+struct Frame *frame_alloc_in(struct Pool *pool, uint32_t msg_len, uint32_t flags)
+{
+    struct Frame *frame;
+
+    frame = pool_alloc(pool, sizeof(struct Frame) + 4 + msg_len);
+    if (frame == NULL)
+        return NULL;
+    frame->pool = pool;
+    frame->memory = NULL;
+    frame->refs = 1;
+    frame->flags = flags;
+    frame->len = 4 + msg_len;
+    frame->data[0] = (msg_len | flags) >> 24;
+    frame->data[1] = msg_len >> 16;
+    frame->data[2] = msg_len >> 8;
+    frame->data[3] = msg_len;
+    return frame;
+}
+
+struct Frame *frame_new_in(struct Pool *pool, const char *msg, uint32_t msg_len, uint32_t flags)
+{
+    struct Frame *frame;
+
+    frame = frame_alloc_in(pool, msg_len, flags);
+    if (frame == NULL)
+        return NULL;
+    memcpy(frame->data + 4, msg, msg_len);
+    return frame;
+}
+
+struct Frame *frame_alloc(uint32_t msg_len, uint32_t flags)
+{
+    return frame_alloc_in(NULL, msg_len, flags);
+}
+
+struct Frame *frame_new(const char *msg, uint32_t msg_len, uint32_t flags)
+{
+    return frame_new_in(NULL, msg, msg_len, flags);
+}
+
+struct Frame *frame_ref(struct Frame *frame)
+{
+    frame->refs++;
+    return frame;
+}
+
+void frame_unref(struct Frame *frame)
+{
+    if (frame != NULL && --frame->refs == 0)
+    {
+        if (frame->memory != NULL)
+        {
+            __atomic_sub_fetch(&frame->memory->bytes, sizeof(struct Frame) + frame->len, __ATOMIC_RELAXED);
+            frame_memory_release(frame->memory);
+        }
+        pool_release(frame->pool, frame, sizeof(struct Frame) + frame->len);
+    }
+}
+
+/* A counter with nothing charged, referenced by its owner */
+struct FrameMemory *frame_memory_new(void)
+{
+    struct FrameMemory *memory;
+
+    memory = malloc(sizeof(struct FrameMemory));
+    if (memory == NULL)
+        return NULL;
+    memory->bytes = 0;
+    memory->refs = 1;
+    return memory;
+}
+
+/* Drop the owner's or a frame's reference, freeing the counter with the last */
+void frame_memory_release(struct FrameMemory *memory)
+{
+    if (memory != NULL && __atomic_sub_fetch(&memory->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(memory);
+}
+
+size_t frame_memory(const struct FrameMemory *memory)
+{
+    return __atomic_load_n(&memory->bytes, __ATOMIC_RELAXED);
+}
+
+/* Count frame against memory until it is freed, unless it already counts against someone */
+void frame_charge(struct Frame *frame, struct FrameMemory *memory)
+{
+    if (frame->memory != NULL || memory == NULL)
+        return;
+    __atomic_add_fetch(&memory->refs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memory->bytes, sizeof(struct Frame) + frame->len, __ATOMIC_RELAXED);
+    frame->memory = memory;
+}
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "journal.h"
+#include "parser.h"
+
+static void segment_path(struct Journal *journal, uint32_t segment, const char *ext, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%08u.%s", journal->dir, segment, ext);
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int index_add(struct Journal *journal, uint64_t seq, uint64_t time_ns)
+{
+    struct JournalIndexEntry *entry;
+    struct JournalIndexEntry *index;
+    size_t cap;
+
+    if (journal->index_count == journal->index_cap)
+    {
+        cap = journal->index_cap ? journal->index_cap * 2 : 1024;
+        index = realloc(journal->index, cap * sizeof(*index));
+        if (index == NULL)
+            return -1;
+        journal->index = index;
+        journal->index_cap = cap;
+    }
+    entry = &journal->index[journal->index_count++];
+    entry->seq = seq;
+    entry->time_ns = time_ns;
+    entry->segment = journal->segment;
+    entry->offset = journal->pos;
+    journal->last_indexed = journal->pos;
+
+    if (write(journal->index_fd, entry, sizeof(*entry)) != sizeof(*entry))
+    {
+        syslog(LOG_ERR, "journal index write failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_index(struct Journal *journal, uint32_t segment)
+{
+    struct JournalIndexEntry entry;
+    struct JournalIndexEntry *index;
+    char path[300];
+    size_t cap;
+    int fd;
+
+    segment_path(journal, segment, "idx", path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    while (read(fd, &entry, sizeof(entry)) == sizeof(entry))
+    {
+        if (journal->index_count == journal->index_cap)
+        {
+            cap = journal->index_cap ? journal->index_cap * 2 : 1024;
+            index = realloc(journal->index, cap * sizeof(entry));
+            if (index == NULL)
+            {
+                /* A partial index would replay from the wrong place */
+                syslog(LOG_ERR, "journal index allocation failed\n");
+                free(journal->index);
+                journal->index = NULL;
+                journal->index_count = 0;
+                journal->index_cap = 0;
+                close(fd);
+                return -1;
+            }
+            journal->index = index;
+            journal->index_cap = cap;
+        }
+        journal->index[journal->index_count++] = entry;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Step over frames from offset until seq reaches target or the data ends.
+ * Only length words are read, the payloads stay in the page cache.
+ */
+static off_t walk_frames(int fd, off_t offset, off_t limit, uint64_t *seq, uint64_t target)
+{
+    unsigned char hdr[4];
+    uint32_t len;
+
+    while (*seq < target && offset + 4 <= limit)
+    {
+        if (pread(fd, hdr, 4, offset) != 4)
+            break;
+        len = (((uint32_t)hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3]) & FRAME_LENGTH_MASK;
+        if (len == 0)
+            break;
+        offset += 4 + len;
+        (*seq)++;
+    }
+    return offset;
+}
+
+static off_t segment_limit(struct Journal *journal, uint32_t segment, int fd)
+{
+    struct stat st;
+
+    if (segment == journal->segment)
+        return journal->pos;
+    if (fstat(fd, &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+static int map_segment(struct Journal *journal, uint32_t segment)
+{
+    char path[300];
+
+    segment_path(journal, segment, "seg", path, sizeof(path));
+    journal->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (journal->fd < 0)
+        goto fail;
+    if (ftruncate(journal->fd, JOURNAL_SEGMENT_SIZE) != 0)
+        goto fail;
+    journal->base = mmap(NULL, JOURNAL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (journal->base == MAP_FAILED)
+        goto fail;
+
+    segment_path(journal, segment, "idx", path, sizeof(path));
+    journal->index_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (journal->index_fd < 0)
+        goto fail;
+
+    journal->segment = segment;
+    journal->pos = 0;
+    journal->last_indexed = 0;
+    return 0;
+
+fail:
+    syslog(LOG_ERR, "journal segment %s: %s (%d)\n", path, strerror(errno), errno);
+    return -1;
+}
+
+/* Trim the active segment to its used size so replays see its true end */
+static void seal_segment(struct Journal *journal)
+{
+    munmap(journal->base, JOURNAL_SEGMENT_SIZE);
+    if (ftruncate(journal->fd, journal->pos) != 0)
+        syslog(LOG_ERR, "journal truncate failed: %s (%d)\n", strerror(errno), errno);
+    close(journal->fd);
+    close(journal->index_fd);
+    journal->base = NULL;
+    journal->fd = -1;
+    journal->index_fd = -1;
+}
+
+static void prune_segments(struct Journal *journal)
+{
+    char path[300];
+    size_t drop;
+
+    while (journal->segment - journal->first_segment > JOURNAL_MAX_SEGMENTS)
+    {
+        segment_path(journal, journal->first_segment, "seg", path, sizeof(path));
+        unlink(path);
+        segment_path(journal, journal->first_segment, "idx", path, sizeof(path));
+        unlink(path);
+
+        drop = 0;
+        while (drop < journal->index_count && journal->index[drop].segment == journal->first_segment)
+            drop++;
+        memmove(journal->index, journal->index + drop, (journal->index_count - drop) * sizeof(*journal->index));
+        journal->index_count -= drop;
+        journal->first_segment++;
+    }
+}
+
+int journal_open(struct Journal *journal, const char *dir)
+{
+    struct JournalIndexEntry *last;
+    struct dirent *ent;
+    unsigned int segment;
+    uint32_t first = UINT32_MAX;
+    uint32_t newest = 0;
+    uint32_t s;
+    int prev_fd;
+    char path[300];
+    off_t end;
+    DIR *d;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    journal->index_fd = -1;
+    snprintf(journal->dir, sizeof(journal->dir), "%s", dir);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        syslog(LOG_ERR, "journal mkdir %s: %s (%d)\n", dir, strerror(errno), errno);
+        return -1;
+    }
+
+    /* Find the segments left by a previous run */
+    d = opendir(dir);
+    if (d == NULL)
+        return -1;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (strlen(ent->d_name) != 12 || sscanf(ent->d_name, "%08u.seg", &segment) != 1 ||
+            strcmp(ent->d_name + 8, ".seg") != 0)
+            continue;
+        if (segment < first)
+            first = segment;
+        if (segment > newest)
+            newest = segment;
+    }
+    closedir(d);
+
+    if (first == UINT32_MAX)
+    {
+        journal->first_segment = 0;
+        return map_segment(journal, 0);
+    }
+
+    journal->first_segment = first;
+    for (s = first; s <= newest; s++)
+    {
+        if (load_index(journal, s) != 0)
+            return -1;
+    }
+
+    /* Reopen the newest segment and find the end of its frames */
+    if (map_segment(journal, newest) != 0)
+        return -1;
+    last = journal->index_count ? &journal->index[journal->index_count - 1] : NULL;
+    if (last != NULL && last->segment == newest)
+    {
+        journal->next_seq = last->seq;
+        journal->pos = walk_frames(journal->fd, last->offset, JOURNAL_SEGMENT_SIZE, &journal->next_seq, UINT64_MAX);
+        journal->last_indexed = last->offset;
+    }
+    else if (last != NULL)
+    {
+        /* Empty newest segment, continue numbering after the previous one */
+        segment_path(journal, last->segment, "seg", path, sizeof(path));
+        prev_fd = open(path, O_RDONLY);
+        journal->next_seq = last->seq;
+        if (prev_fd >= 0)
+        {
+            end = lseek(prev_fd, 0, SEEK_END);
+            walk_frames(prev_fd, last->offset, end, &journal->next_seq, UINT64_MAX);
+            close(prev_fd);
+        }
+    }
+    return 0;
+}
+
+int journal_append(struct Journal *journal, const char *msg, uint32_t len, uint32_t flags)
+{
+    uint32_t word = len | flags;
+    unsigned char *p;
+
+    /* A zero length word marks the end of a segment's frames */
+    if (len == 0)
+        return 0;
+    if (len + 4 > JOURNAL_SEGMENT_SIZE)
+        return -1;
+
+    if (journal->pos + 4 + len > JOURNAL_SEGMENT_SIZE)
+    {
+        seal_segment(journal);
+        if (map_segment(journal, journal->segment + 1) != 0)
+            return -1;
+        prune_segments(journal);
+    }
+    if (journal->pos == 0 || journal->pos - journal->last_indexed >= JOURNAL_INDEX_INTERVAL)
+    {
+        if (index_add(journal, journal->next_seq, wall_ns()) != 0)
+            return -1;
+    }
+
+    p = (unsigned char *)journal->base + journal->pos;
+    p[0] = word >> 24;
+    p[1] = word >> 16;
+    p[2] = word >> 8;
+    p[3] = word;
+    memcpy(p + 4, msg, len);
+    journal->pos += 4 + len;
+    journal->next_seq++;
+    return 0;
+}
+
+static int cursor_open(struct Journal *journal, struct JournalCursor *cursor, uint32_t segment, off_t offset)
+{
+    char path[300];
+
+    segment_path(journal, segment, "seg", path, sizeof(path));
+    cursor->fd = open(path, O_RDONLY);
+    if (cursor->fd < 0)
+    {
+        syslog(LOG_ERR, "journal open %s: %s (%d)\n", path, strerror(errno), errno);
+        return -1;
+    }
+    cursor->segment = segment;
+    cursor->offset = offset;
+    return 0;
+}
+
+/* Position of the last index entry whose seq (or time) is <= value, or 0 */
+static size_t index_search(struct Journal *journal, uint64_t value, int by_time)
+{
+    size_t lo = 0;
+    size_t hi = journal->index_count;
+    size_t mid;
+    uint64_t key;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        key = by_time ? journal->index[mid].time_ns : journal->index[mid].seq;
+        if (key <= value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? lo - 1 : 0;
+}
+
+int journal_seek_seq(struct Journal *journal, uint64_t seq, struct JournalCursor *cursor)
+{
+    struct JournalIndexEntry *entry;
+    uint64_t at;
+
+    if (seq >= journal->next_seq || journal->index_count == 0)
+        return cursor_open(journal, cursor, journal->segment, journal->pos);
+
+    entry = &journal->index[index_search(journal, seq, 0)];
+    if (cursor_open(journal, cursor, entry->segment, entry->offset) != 0)
+        return -1;
+    at = entry->seq;
+    cursor->offset = walk_frames(cursor->fd, entry->offset, segment_limit(journal, entry->segment, cursor->fd), &at, seq);
+    return 0;
+}
+
+/*
+ * Start at the newest index entry not after time_ns. The index is sparse, so
+ * up to JOURNAL_INDEX_INTERVAL bytes of older frames may be replayed too, but
+ * nothing at or after time_ns is skipped.
+ */
+int journal_seek_time(struct Journal *journal, uint64_t time_ns, struct JournalCursor *cursor)
+{
+    struct JournalIndexEntry *entry;
+
+    if (journal->index_count == 0)
+        return cursor_open(journal, cursor, journal->segment, journal->pos);
+
+    entry = &journal->index[index_search(journal, time_ns, 1)];
+    return cursor_open(journal, cursor, entry->segment, entry->offset);
+}
+
+/*
+ * Stream journaled frames to sockfd with sendfile, at most
+ * JOURNAL_REPLAY_CHUNK bytes per call. Returns 1 once the cursor has caught
+ * up with the head of the journal, 0 when more remains, -1 on error.
+ */
+int journal_replay(struct Journal *journal, struct JournalCursor *cursor, int sockfd)
+{
+    size_t budget = JOURNAL_REPLAY_CHUNK;
+    uint32_t next;
+    off_t limit;
+    ssize_t n;
+    size_t len;
+
+    for (;;)
+    {
+        limit = segment_limit(journal, cursor->segment, cursor->fd);
+        if (cursor->offset < limit)
+        {
+            if (budget == 0)
+                return 0;
+            len = limit - cursor->offset;
+            if (len > budget)
+                len = budget;
+            n = sendfile(sockfd, cursor->fd, &cursor->offset, len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;
+                syslog(LOG_ERR, "journal sendfile failed: %s (%d)\n", strerror(errno), errno);
+                return -1;
+            }
+            if (n == 0)
+                return -1;
+            budget -= n;
+            continue;
+        }
+
+        if (cursor->segment == journal->segment)
+        {
+            journal_cursor_close(cursor);
+            return 1;
+        }
+
+        /* Move on to the next segment, skipping any pruned meanwhile */
+        next = cursor->segment + 1;
+        if (next < journal->first_segment)
+            next = journal->first_segment;
+        close(cursor->fd);
+        cursor->fd = -1;
+        if (cursor_open(journal, cursor, next, 0) != 0)
+            return -1;
+    }
+}
+
+void journal_cursor_close(struct JournalCursor *cursor)
+{
+    if (cursor->fd >= 0)
+        close(cursor->fd);
+    cursor->fd = -1;
+}
+
+void journal_close(struct Journal *journal)
+{
+    if (journal->base != NULL)
+        seal_segment(journal);
+    free(journal->index);
+    journal->index = NULL;
+    journal->index_count = 0;
+    journal->index_cap = 0;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "log.h"
+
+int logLevel = LOG_NOTICE;
+
+static void logMessage(int priority, const char *name, const char *format, va_list args)
+{
+    va_list copy;
+    char stamp[32];
+    time_t now;
+
+    if (priority > logLevel)
+        return;
+    va_copy(copy, args);
+    vsyslog(priority, format, copy);
+    va_end(copy);
+
+    now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(stderr, "%s %s: ", stamp, name);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    fflush(stderr);
+}
+
+void logError(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    logMessage(LOG_ERR, "error", format, args);
+    va_end(args);
+}
+
+void logNotice(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    logMessage(LOG_NOTICE, "notice", format, args);
+    va_end(args);
+}
+
+void logDebug(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    logMessage(LOG_DEBUG, "debug", format, args);
+    va_end(args);
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "logrotate.h"
+
+extern char **environ;
+
+static struct
+{
+    char path[4096];
+    size_t max_bytes;
+    unsigned int max_seconds;
+    time_t opened;
+    pthread_t thread;
+    sem_t wake;
+    volatile int running;
+    volatile int reopen;
+} logrotate;
+
+/* Compress a rotated segment in a child, so a slow gzip holds nobody up */
+static void compress_segment(const char *segment)
+{
+    char *argv[] = {"gzip", "-f", "-q", (char *)segment, NULL};
+    pid_t pid;
+    int error;
+
+    error = posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ);
+    if (error != 0)
+    {
+        syslog(LOG_ERR, "gzip failed: %s (%d)\n", strerror(error), error);
+        return;
+    }
+    /* Fails with ECHILD once daemonize() has SIGCHLD ignored, after gzip exits */
+    waitpid(pid, NULL, 0);
+}
+
+/* Whether a segment, or its compressed copy, is already there */
+static int segment_exists(const char *segment)
+{
+    char gz[sizeof(logrotate.path) + 40];
+
+    snprintf(gz, sizeof(gz), "%s.gz", segment);
+    return access(segment, F_OK) == 0 || access(gz, F_OK) == 0;
+}
+
+/*
+ * Swap a fresh log in under stdout and stderr. When rename is set the
+ * current file is moved aside first and compressed once both descriptors
+ * point at the new one; otherwise the path is just reopened, for a file an
+ * external tool already moved away.
+ */
+static void rotate(int rename_current)
+{
+    char segment[sizeof(logrotate.path) + 32];
+    struct tm tm;
+    time_t now = time(NULL);
+    unsigned int seq;
+    int len;
+    int fd;
+
+    segment[0] = '\0';
+    if (rename_current)
+    {
+        localtime_r(&now, &tm);
+        len = snprintf(segment, sizeof(segment), "%s.%04d%02d%02d-%02d%02d%02d", logrotate.path, tm.tm_year + 1900,
+                       tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        /* Two rotations within a second must not land on one name */
+        for (seq = 1; segment_exists(segment); seq++)
+            snprintf(segment + len, sizeof(segment) - len, ".%u", seq);
+        if (rename(logrotate.path, segment) == -1)
+        {
+            syslog(LOG_ERR, "log rename failed: %s (%d)\n", strerror(errno), errno);
+            return;
+        }
+    }
+
+    fd = open(logrotate.path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1)
+    {
+        /* Writers carry on in the old file until the next attempt */
+        syslog(LOG_ERR, "log reopen failed: %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+    if (dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1)
+        syslog(LOG_ERR, "log dup2 failed: %s (%d)\n", strerror(errno), errno);
+    close(fd);
+    logrotate.opened = now;
+
+    if (segment[0] != '\0')
+        compress_segment(segment);
+}
+
+static void *logrotate_thread(void *arg)
+{
+    struct timespec deadline;
+    struct stat st;
+
+    (void)arg;
+    while (logrotate.running)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += LOGROTATE_CHECK_MS / 1000;
+        deadline.tv_nsec += LOGROTATE_CHECK_MS % 1000 * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&logrotate.wake, &deadline) == -1 && errno == EINTR)
+            ;
+        if (!logrotate.running)
+            break;
+
+        if (logrotate.reopen)
+        {
+            logrotate.reopen = 0;
+            rotate(0);
+        }
+        else if ((logrotate.max_bytes > 0 && fstat(STDOUT_FILENO, &st) == 0 && (size_t)st.st_size >= logrotate.max_bytes) ||
+                 (logrotate.max_seconds > 0 && time(NULL) - logrotate.opened >= logrotate.max_seconds))
+        {
+            rotate(1);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Start rotating the log at path, which must be absolute once daemonize()
+ * has changed directory. A zero limit disables that trigger.
+ */
+int logrotate_start(const char *path, size_t max_bytes, unsigned int max_seconds)
+{
+    int error;
+
+    if (strlen(path) >= sizeof(logrotate.path))
+    {
+        syslog(LOG_ERR, "log path too long\n");
+        return -1;
+    }
+    strcpy(logrotate.path, path);
+    logrotate.max_bytes = max_bytes;
+    logrotate.max_seconds = max_seconds;
+    logrotate.opened = time(NULL);
+    logrotate.reopen = 0;
+    logrotate.running = 1;
+    if (sem_init(&logrotate.wake, 0, 0) == -1)
+    {
+        syslog(LOG_ERR, "sem_init failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    error = pthread_create(&logrotate.thread, NULL, logrotate_thread, NULL);
+    if (error != 0)
+    {
+        syslog(LOG_ERR, "pthread_create failed: %s (%d)\n", strerror(error), error);
+        sem_destroy(&logrotate.wake);
+        logrotate.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Reopen the log at its path, safe from a signal handler such as SIGHUP's */
+void logrotate_reopen(void)
+{
+    if (!logrotate.running)
+        return;
+    logrotate.reopen = 1;
+    sem_post(&logrotate.wake);
+}
+
+void logrotate_stop(void)
+{
+    if (!logrotate.running)
+        return;
+    logrotate.running = 0;
+    sem_post(&logrotate.wake);
+    pthread_join(logrotate.thread, NULL);
+    sem_destroy(&logrotate.wake);
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+
+#include "looplag.h"
+
+static const char *const phase_names[LAG_PHASES] = {"other", "poll", "accept", "read", "parse", "fanout", "flush", "busy"};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Bucket i counts durations under 2^i us, from 2^(i-1) us on */
+static int bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    int i;
+
+    if (us == 0)
+        return 0;
+    i = 64 - __builtin_clzll(us);
+    return i < LAG_BUCKETS ? i : LAG_BUCKETS - 1;
+}
+
+static void count(uint64_t *counter, uint64_t by)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + by, __ATOMIC_RELAXED);
+}
+
+/*
+ * Look in on the loop a few times per threshold and report a pass that has
+ * been busy for longer, once, naming the phase it is stuck in.
+ */
+static void *watchdog(void *arg)
+{
+    struct LoopLag *lag = arg;
+    struct timespec period;
+    uint64_t period_ns = lag->threshold_ns / 4;
+    uint64_t since;
+    uint64_t now;
+
+    if (period_ns < 1000000)
+        period_ns = 1000000;
+    period.tv_sec = period_ns / 1000000000ull;
+    period.tv_nsec = period_ns % 1000000000ull;
+    while (lag->running)
+    {
+        nanosleep(&period, NULL);
+        since = __atomic_load_n(&lag->busy_since, __ATOMIC_ACQUIRE);
+        now = now_ns();
+        if (since == 0 || since == lag->flagged || now - since < lag->threshold_ns)
+            continue;
+        lag->flagged = since;
+        count(&lag->stalls, 1);
+        syslog(LOG_WARNING, "event loop stalled for %llu ms in %s\n", (unsigned long long)((now - since) / 1000000),
+               phase_names[__atomic_load_n(&lag->phase, __ATOMIC_RELAXED)]);
+    }
+    return NULL;
+}
+
+int lag_start(struct LoopLag *lag, uint64_t threshold_ns)
+{
+    int error;
+
+    memset(lag, 0, sizeof(*lag));
+    lag->threshold_ns = threshold_ns;
+    lag->running = 1;
+    error = pthread_create(&lag->watchdog, NULL, watchdog, lag);
+    if (error != 0)
+    {
+        syslog(LOG_ERR, "pthread_create failed: %s (%d)\n", strerror(error), error);
+        lag->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void lag_stop(struct LoopLag *lag)
+{
+    if (lag->running)
+    {
+        lag->running = 0;
+        pthread_join(lag->watchdog, NULL);
+    }
+}
+
+void lag_begin(struct LoopLag *lag, uint64_t now)
+{
+    memset(lag->pass_ns, 0, sizeof(lag->pass_ns));
+    lag->mark = now;
+    __atomic_store_n(&lag->phase, LAG_OTHER, __ATOMIC_RELAXED);
+    __atomic_store_n(&lag->busy_since, now, __ATOMIC_RELEASE);
+}
+
+/* Close the pass, adding what each phase took to its histogram */
+void lag_end(struct LoopLag *lag, uint64_t now)
+{
+    uint64_t busy = 0;
+    int i;
+
+    lag_phase(lag, LAG_POLL, now);
+    for (i = 0; i < LAG_BUSY; i++)
+    {
+        if (lag->pass_ns[i] == 0)
+            continue;
+        count(&lag->hist[i][bucket(lag->pass_ns[i])], 1);
+        if (i != LAG_POLL)
+            busy += lag->pass_ns[i];
+    }
+    count(&lag->hist[LAG_BUSY][bucket(busy)], 1);
+    count(&lag->passes, 1);
+    if (busy >= lag->threshold_ns)
+        count(&lag->slow, 1);
+    if (busy > lag->max_ns)
+        __atomic_store_n(&lag->max_ns, busy, __ATOMIC_RELAXED);
+}
+
+/*
+ * Write the counters and, per phase, the non-empty buckets as upper bound
+ * in us and count, in the admin socket's "name value" lines.
+ */
+int lag_metrics(int fd, void *arg)
+{
+    struct LoopLag *lag = arg;
+    char buf[LAG_PHASES * LAG_BUCKETS * 24 + 256];
+    uint64_t n;
+    size_t len;
+    size_t done;
+    ssize_t written;
+    int i;
+    int b;
+
+    len = snprintf(buf, sizeof(buf), "loop_passes %llu\nloop_slow %llu\nloop_stalls %llu\nloop_max_us %llu\n",
+                   (unsigned long long)__atomic_load_n(&lag->passes, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&lag->slow, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&lag->stalls, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&lag->max_ns, __ATOMIC_RELAXED) / 1000);
+    /* snprintf returns what it would have written, a full buffer cuts the output short instead */
+    if (len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    for (i = 0; i < LAG_PHASES; i++)
+    {
+        len += snprintf(buf + len, sizeof(buf) - len, "loop_us %s", phase_names[i]);
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        for (b = 0; b < LAG_BUCKETS; b++)
+        {
+            n = __atomic_load_n(&lag->hist[i][b], __ATOMIC_RELAXED);
+            if (n > 0)
+                len += snprintf(buf + len, sizeof(buf) - len, " %llu:%llu", 1ull << b, (unsigned long long)n);
+            if (len >= sizeof(buf))
+                len = sizeof(buf) - 1;
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "\n");
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+    }
+
+    for (done = 0; done < len; done += written)
+    {
+        written = write(fd, buf + done, len - done);
+        if (written < 0 && errno != EINTR)
+            return -1;
+        if (written < 0)
+            written = 0;
+    }
+    return 0;
+}
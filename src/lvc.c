@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lvc.h"
+
+/* Refuse new keys past this fill level to keep probe chains short */
+#define LVC_MAX_LOAD(lvc) (((lvc)->mask + 1) / 4 * 3)
+
+static int frame_key(struct Frame *frame, const char **key, uint32_t *key_len)
+{
+    uint32_t len = (unsigned char)frame->data[4];
+
+    if (frame->len < 5 || len == 0 || 5 + len > frame->len)
+        return -1;
+    *key = frame->data + 5;
+    *key_len = len;
+    return 0;
+}
+
+static uint64_t key_hash(const char *key, uint32_t len)
+{
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ull;
+    }
+    return hash | 1;
+}
+
+int lvc_init(struct Lvc *lvc, uint32_t capacity)
+{
+    lvc->slots = calloc(capacity, sizeof(struct LvcSlot));
+    if (lvc->slots == NULL)
+        return -1;
+    lvc->mask = capacity - 1;
+    lvc->count = 0;
+    return 0;
+}
+
+/*
+ * Store frame as the latest value of its key. Returns the slot the key lives
+ * in, or -1 if the frame is unkeyed or the cache is full, in which case the
+ * frame is relayed without conflation.
+ */
+int lvc_put(struct Lvc *lvc, struct Frame *frame)
+{
+    struct LvcSlot *slot;
+    const char *key;
+    const char *other;
+    uint32_t key_len;
+    uint32_t other_len;
+    uint64_t hash;
+    uint32_t i;
+
+    if (frame_key(frame, &key, &key_len) != 0)
+        return -1;
+    hash = key_hash(key, key_len);
+
+    for (i = hash & lvc->mask;; i = (i + 1) & lvc->mask)
+    {
+        slot = &lvc->slots[i];
+        if (slot->hash == 0)
+        {
+            if (lvc->count >= LVC_MAX_LOAD(lvc))
+                return -1;
+            lvc->count++;
+            break;
+        }
+        if (slot->hash == hash && frame_key(slot->value, &other, &other_len) == 0 &&
+            other_len == key_len && memcmp(other, key, key_len) == 0)
+            break;
+    }
+
+    frame_unref(slot->value);
+    slot->hash = hash;
+    slot->value = frame_ref(frame);
+    return i;
+}
+
+void lvc_free(struct Lvc *lvc)
+{
+    uint32_t i;
+
+    for (i = 0; i <= lvc->mask; i++)
+        frame_unref(lvc->slots[i].value);
+    free(lvc->slots);
+    lvc->slots = NULL;
+}
+
+/* Remember that slot changed while the client could not take it */
+int conflate_mark(struct ConflateSet *set, struct Lvc *lvc, uint32_t slot)
+{
+    if (set->ring == NULL)
+    {
+        set->ring = malloc((lvc->mask + 1) * sizeof(uint32_t));
+        set->pending = calloc((lvc->mask + 1) / 8, 1);
+        if (set->ring == NULL || set->pending == NULL)
+        {
+            conflate_clear(set);
+            return -1;
+        }
+    }
+    if (set->pending[slot / 8] & (1 << (slot % 8)))
+        return 0;
+    set->pending[slot / 8] |= 1 << (slot % 8);
+    set->ring[(set->head + set->count) & lvc->mask] = slot;
+    set->count++;
+    return 0;
+}
+
+/* Queue every cached key, used to bring a new subscriber up to date */
+int conflate_snapshot(struct ConflateSet *set, struct Lvc *lvc)
+{
+    uint32_t i;
+
+    for (i = 0; i <= lvc->mask; i++)
+    {
+        if (lvc->slots[i].hash != 0 && conflate_mark(set, lvc, i) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Next slot whose current value the client still has to receive, or -1 */
+int conflate_pop(struct ConflateSet *set, struct Lvc *lvc)
+{
+    uint32_t slot;
+
+    if (set->count == 0)
+        return -1;
+    slot = set->ring[set->head];
+    set->head = (set->head + 1) & lvc->mask;
+    set->count--;
+    set->pending[slot / 8] &= ~(1 << (slot % 8));
+    return slot;
+}
+
+void conflate_clear(struct ConflateSet *set)
+{
+    free(set->ring);
+    free(set->pending);
+    memset(set, 0, sizeof(*set));
+}
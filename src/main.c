@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ctype.h>
+
+#include "daemonize.h"
+#include "config.h"
+#include "log.h"
+#include "relay.h"
+#include "logrotate.h"
+#include "flightrec.h"
+#include "admin.h"
+
+#define DEFAULT_PORT "8080"
+#define DEFAULT_MAX_CLIENTS 10
+#define PIDFILE "/var/etc/daemonize.pid"
+
+/* The relay SIGTERM stops, the only state main shares with a handler */
+static struct Relay *running_relay = NULL;
+
+static void sig_handler(int signo)
+{
+    if (signo == SIGTERM && running_relay != NULL)
+        relay_stop(running_relay);
+    else if (signo == SIGHUP)
+        logrotate_reopen();
+}
+
+static void showHelp()
+{
+    printf("Usage: daemonize [options]\n");
+    printf("Options:\n");
+    printf("\t-c <file>\tConfiguration file\n");
+    printf("\t-n <name>\tConfiguration name\n");
+    printf("\t-u <port>\tRelay datagrams received on UDP port\n");
+    printf("\t-g <group>\tJoin multicast group on the UDP port\n");
+    printf("\t-s <host:port>\tRepublish datagrams to endpoint or group (repeatable)\n");
+    printf("\t-j <dir>\tJournal relayed frames for replay\n");
+    printf("\t-k\t\tConflate keyed frames for slow consumers\n");
+    printf("\t-w <us>[,<bytes>]\tCoalesce frames per recipient for up to us microseconds or bytes\n");
+    printf("\t-r <frames>[,<bytes>]\tLimit each client to frames and bytes per second\n");
+    printf("\t-z <bytes>[,<bytes>]\tSend frames this large zero-copy, splice frames of the second size\n");
+    printf("\t-t <cert>,<key>\tServe clients over TLS offloaded to the kernel (make TLS=1), overrides tlsCert and tlsKey\n");
+    printf("\t-M <bytes>[,<bytes>]\tShed load past this much memory in total and per client\n");
+    printf("\t-B <us>[,<us>]\tPoll this long before sleeping, and set SO_BUSY_POLL on the sockets\n");
+    printf("\t-H <bytes>[,htp]\tPool frames and clients on the loop's NUMA node; hugetlb, THP, prefault\n");
+    printf("\t-W <format>\tFrame headers: legacy (4-byte length), fixed (versioned 20 bytes) or compact (varint)\n");
+    printf("\t-C <file>\tCapture every frame clients send, for tools/replay\n");
+    printf("\t-L <ms>\t\tTime each loop pass by phase and report passes busy for longer, see the admin metrics\n");
+    printf("\t-S <threads>\tSender threads that share out frames going to many clients\n");
+    printf("\t-I <id>\t\tFederate with other nodes under this non-zero node id\n");
+    printf("\t-P <host:port>\tLink to the node at endpoint (repeatable, needs -I)\n");
+    printf("\t-U <path>\tServe local clients over shared memory rings negotiated on a unix socket\n");
+    printf("\t-R <bytes>[,<s>]\tRotate the log file at this size or age, SIGHUP reopens it\n");
+    printf("\t-F <file>\tDump the flight recorder here on a crash, a failed exit or SIGUSR1 (absolute)\n");
+    printf("\t-A <path>\tAdmin unix socket answering flightrec and metrics\n");
+    printf("\t-h\t\tShow this help\n");
+    printf("\t-V\t\tShow version\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char *configFile = NULL;
+    char *configName = NULL;
+    struct RelayConfig config;
+    struct Relay *relay;
+    char *logFile = NULL;
+    char *logPath = NULL;
+    char *tlsCert = NULL;
+    char *tlsKey = NULL;
+    char *tlsCertPath = NULL;
+    char *tlsKeyPath = NULL;
+    char *dumpFile = NULL;
+    char *adminPath = NULL;
+    size_t rotateBytes = 0;
+    unsigned int rotateSeconds = 0;
+    int logFd = -1;
+    int result;
+    char *end;
+    int c;
+
+    relay_config_init(&config);
+
+    /* Read options */
+    opterr = 0;
+    while ((c = getopt(argc, argv, "c:n:u:g:s:j:kw:r:z:t:M:I:P:U:R:F:A:B:H:W:C:L:S:Vh")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            configFile = optarg;
+            break;
+        case 'n':
+            configName = optarg;
+            break;
+        case 'u':
+            config.udpPort = atoi(optarg);
+            break;
+        case 'g':
+            config.udpGroup = optarg;
+            break;
+        case 's':
+            if (config.udpSubscriberCount >= UDP_MAX_SUBSCRIBERS)
+            {
+                fprintf(stderr, "Too many UDP subscribers.\n");
+                exit(1);
+            }
+            config.udpSubscribers[config.udpSubscriberCount++] = optarg;
+            break;
+        case 'j':
+            config.journalDir = optarg;
+            break;
+        case 'k':
+            config.conflate = 1;
+            break;
+        case 'w':
+            config.window.ns = strtoull(optarg, &end, 10) * 1000;
+            config.window.bytes = *end == ',' ? strtoul(end + 1, NULL, 10) : OUTQ_WINDOW_BYTES;
+            break;
+        case 'r':
+            config.rateFrames = strtod(optarg, &end);
+            config.rateBytes = *end == ',' ? strtod(end + 1, NULL) : 0;
+            break;
+        case 'z':
+            config.zerocopyMin = strtoul(optarg, &end, 10);
+            config.spliceMin = *end == ',' ? strtoul(end + 1, NULL, 10) : 0;
+            break;
+        case 't':
+            end = strchr(optarg, ',');
+            if (end == NULL)
+            {
+                fprintf(stderr, "Option -t requires <cert>,<key>.\n");
+                exit(1);
+            }
+            *end = '\0';
+            config.tlsCert = optarg;
+            config.tlsKey = end + 1;
+            break;
+        case 'M':
+            config.memLimit = strtoull(optarg, &end, 10);
+            config.clientMemLimit = *end == ',' ? strtoull(end + 1, NULL, 10) : 0;
+            break;
+        case 'B':
+            config.busyPoll = strtol(optarg, &end, 10);
+            config.busyPollSocket = *end == ',' ? strtol(end + 1, NULL, 10) : 0;
+            break;
+        case 'H':
+            config.poolSize = strtoull(optarg, &end, 10);
+            for (config.poolFlags = 0; *end != '\0'; end++)
+            {
+                if (*end == 'h')
+                    config.poolFlags |= POOL_HUGETLB;
+                else if (*end == 't')
+                    config.poolFlags |= POOL_THP;
+                else if (*end == 'p')
+                    config.poolFlags |= POOL_PREFAULT;
+            }
+            break;
+        case 'W':
+            if (strcmp(optarg, "fixed") == 0)
+                config.wire = WIRE_FIXED;
+            else if (strcmp(optarg, "compact") == 0)
+                config.wire = WIRE_COMPACT;
+            else if (strcmp(optarg, "legacy") != 0)
+            {
+                fprintf(stderr, "Unknown wire format `%s'.\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'C':
+            config.captureFile = optarg;
+            break;
+        case 'L':
+            config.lagThreshold = atoi(optarg);
+            break;
+        case 'S':
+            config.senderThreads = atoi(optarg);
+            break;
+        case 'I':
+            config.nodeId = strtoull(optarg, NULL, 10);
+            break;
+        case 'P':
+            if (config.peerCount >= PEER_MAX)
+            {
+                fprintf(stderr, "Too many peers.\n");
+                exit(1);
+            }
+            config.peers[config.peerCount++] = optarg;
+            break;
+        case 'U':
+            config.unixPath = optarg;
+            break;
+        case 'R':
+            rotateBytes = strtoull(optarg, &end, 10);
+            rotateSeconds = *end == ',' ? strtoul(end + 1, NULL, 10) : 0;
+            break;
+        case 'F':
+            dumpFile = optarg;
+            break;
+        case 'A':
+            adminPath = optarg;
+            break;
+        case 'V':
+            printf("daemonize %s\n", getVersion());
+            exit(0);
+        case 'h':
+            showHelp();
+            exit(0);
+        case '?':
+            if (optopt == 'c' || optopt == 'n' || optopt == 'u' || optopt == 'g' || optopt == 's' || optopt == 'j' || optopt == 'w' || optopt == 'r' || optopt == 'z' || optopt == 't' || optopt == 'M' || optopt == 'I' || optopt == 'P' || optopt == 'U' || optopt == 'R' || optopt == 'F' || optopt == 'A' || optopt == 'B' || optopt == 'H' || optopt == 'W' || optopt == 'C' || optopt == 'L' || optopt == 'S')
+                fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+            else if (isprint(optopt))
+                fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+            else
+                fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+            exit(1);
+        default:
+            abort();
+        }
+    }
+
+    /* From here on a failed exit leaves the recorder behind */
+    if (dumpFile != NULL && flightrec_install(dumpFile) != 0)
+    {
+        fprintf(stderr, "Failed to install the flight recorder dump.\n");
+        exit(1);
+    }
+
+    if (configFile == NULL)
+    {
+        logError("Configuration file not specified");
+        exit(1);
+    }
+    if (configName == NULL)
+    {
+        logError("Configuration name not specified");
+        exit(1);
+    }
+
+    /* Read configuration */
+    if (readConfig(configFile, configName, &config.port, &config.maxClients, &logLevel, &logFile, &tlsCert, &tlsKey) != 0)
+        exit(1);
+    if (logFile != NULL)
+    {
+        logFd = open(logFile, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (logFd == -1)
+            exit(1);
+        /* daemonize() changes directory, rotation needs the full path */
+        logPath = realpath(logFile, NULL);
+        if (logPath == NULL)
+            exit(1);
+    }
+
+    /* -t wins over the file; the relay loads both after daemonize() too */
+    if (config.tlsCert == NULL)
+    {
+        config.tlsCert = tlsCert;
+        config.tlsKey = tlsKey;
+    }
+    if (config.tlsCert != NULL || config.tlsKey != NULL)
+    {
+        if (config.tlsCert == NULL || config.tlsKey == NULL)
+        {
+            logError("tlsCert and tlsKey must be given together");
+            exit(1);
+        }
+        tlsCertPath = realpath(config.tlsCert, NULL);
+        tlsKeyPath = realpath(config.tlsKey, NULL);
+        if (tlsCertPath == NULL || tlsKeyPath == NULL)
+        {
+            logError("Failed to find the TLS certificate and key");
+            exit(1);
+        }
+        config.tlsCert = tlsCertPath;
+        config.tlsKey = tlsKeyPath;
+    }
+
+    /* Daemonize */
+    if (daemonize("/var/run/daemonize", PIDFILE, logFd) != 0)
+        exit(1);
+
+    logNotice("Initializing...");
+
+    /* Rotate the log from a thread, started here as threads do not survive fork */
+    if (logPath != NULL)
+    {
+        if (logrotate_start(logPath, rotateBytes, rotateSeconds) != 0)
+        {
+            logError("Failed to start log rotation");
+            exit(1);
+        }
+        signal(SIGHUP, sig_handler);
+    }
+    if (adminPath != NULL && admin_start(adminPath) != 0)
+    {
+        logError("Failed to open the admin socket");
+        exit(1);
+    }
+
+    relay = relay_new(&config, NULL);
+    if (relay == NULL)
+    {
+        logError("Failed to allocate relay");
+        exit(1);
+    }
+    if (relay_listen(relay) != 0)
+    {
+        logError("Failed to open relay sockets");
+        exit(1);
+    }
+    running_relay = relay;
+    signal(SIGTERM, sig_handler);
+    /* splice() to a closed socket raises SIGPIPE, there is no MSG_NOSIGNAL for it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Main loop */
+    logNotice("Listening for clients...");
+    result = relay_run(relay);
+    if (result != 0)
+        logError("Failed to wait for activity");
+
+    running_relay = NULL;
+    relay_free(relay);
+    admin_stop();
+    logrotate_stop();
+    free(logPath);
+    free(tlsCertPath);
+    free(tlsKeyPath);
+    free(tlsCert);
+    free(tlsKey);
+    return result != 0;
+}
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "outq.h"
+
+/* Bytes frame takes on the wire in the queue's format */
+static size_t wire_len(struct OutQueue *queue, struct Frame *frame)
+{
+    if (queue->wire == WIRE_LEGACY)
+        return frame->len;
+    return wire_header_size(queue->wire, frame->len - 4) + frame->len - 4;
+}
+
+/*
+ * Queue the unsent part of frame on a lane, taking a reference. A non-zero
+ * offset is only valid on an empty queue, for the tail of a frame whose
+ * first bytes went out directly. Returns -1 when the queue is full.
+ */
+int outq_push(struct OutQueue *queue, struct Frame *frame, size_t offset, int lane)
+{
+    struct OutLane *l = &queue->lanes[lane];
+
+    if (l->count == OUTQ_MAX_FRAMES || queue->bytes + wire_len(queue, frame) - offset > OUTQ_MAX_BYTES)
+        return -1;
+    if (l->frames == NULL)
+    {
+        l->frames = malloc(OUTQ_MAX_FRAMES * sizeof(struct Frame *));
+        if (l->frames == NULL)
+            return -1;
+    }
+    if (queue->count == 0)
+    {
+        queue->offset = offset;
+        queue->partial_lane = lane;
+    }
+    l->frames[(l->head + l->count) % OUTQ_MAX_FRAMES] = frame_ref(frame);
+    l->count++;
+    queue->count++;
+    queue->bytes += wire_len(queue, frame) - offset;
+    return 0;
+}
+
+static struct Frame *lane_pop(struct OutLane *l)
+{
+    struct Frame *frame = l->frames[l->head];
+
+    l->head = (l->head + 1) % OUTQ_MAX_FRAMES;
+    l->count--;
+    return frame;
+}
+
+/*
+ * Point iov at what is left of frame past offset, with its header encoded
+ * into header first unless it is in the 4-byte framing. Returns the number
+ * of iovecs used.
+ */
+static unsigned int frame_iov(struct OutQueue *queue, struct iovec *iov, unsigned char *header, struct Frame *frame, size_t offset,
+                              uint64_t sequence)
+{
+    size_t header_len;
+    unsigned int n = 0;
+
+    if (queue->wire == WIRE_LEGACY)
+    {
+        iov[0].iov_base = frame->data + offset;
+        iov[0].iov_len = frame->len - offset;
+        return 1;
+    }
+    header_len = wire_header(queue->wire, header, frame->len - 4, frame->flags, sequence);
+    if (offset < header_len)
+    {
+        iov[n].iov_base = header + offset;
+        iov[n++].iov_len = header_len - offset;
+        offset = header_len;
+    }
+    if (frame->len - 4 > offset - header_len)
+    {
+        iov[n].iov_base = frame->data + 4 + offset - header_len;
+        iov[n++].iov_len = frame->len - 4 - (offset - header_len);
+    }
+    return n;
+}
+
+/*
+ * Write as much of the queue as the socket takes, up to OUTQ_IOV frames per
+ * gathered send: the partly sent frame if any, then the high lane, then the
+ * low lane. A large enough send goes out with MSG_ZEROCOPY when zc allows
+ * it, and the frames it covers stay referenced by zc until the kernel is
+ * done with them. With a ring the frames are copied into it instead of
+ * being sent. Returns 1 once the queue is empty, 0 if the socket or ring
+ * filled up first, or -1 on a socket error.
+ */
+int outq_flush(struct OutQueue *queue, int sockfd, struct ZeroCopy *zc, struct ShmRing *ring)
+{
+    struct iovec iov[2 * OUTQ_IOV];
+    unsigned char headers[OUTQ_IOV][WIRE_MAX_HEADER];
+    struct Frame *frames[OUTQ_IOV];
+    size_t frame_len[OUTQ_IOV];
+    unsigned char lane_of[OUTQ_IOV];
+    struct OutLane *l;
+    struct msghdr msg;
+    struct Frame *frame;
+    unsigned int skip[OUTQ_LANES];
+    unsigned int iovs;
+    unsigned int k;
+    unsigned int n;
+    unsigned int i;
+    size_t total;
+    size_t len;
+    ssize_t sent;
+    int copy = 0;
+    int flags;
+    int lane;
+
+    while (queue->count > 0)
+    {
+        n = 0;
+        iovs = 0;
+        total = 0;
+        skip[OUTQ_HIGH] = 0;
+        skip[OUTQ_LOW] = 0;
+        if (queue->offset > 0)
+        {
+            l = &queue->lanes[queue->partial_lane];
+            frame = l->frames[l->head];
+            k = frame_iov(queue, iov + iovs, headers[n], frame, queue->offset, queue->sequence);
+            frame_len[n] = wire_len(queue, frame) - queue->offset;
+            total += frame_len[n];
+            iovs += k;
+            frames[n] = frame;
+            lane_of[n++] = queue->partial_lane;
+            skip[queue->partial_lane] = 1;
+        }
+        for (lane = 0; lane < OUTQ_LANES; lane++)
+        {
+            l = &queue->lanes[lane];
+            for (i = skip[lane]; i < l->count && n < OUTQ_IOV; i++)
+            {
+                frame = l->frames[(l->head + i) % OUTQ_MAX_FRAMES];
+                k = frame_iov(queue, iov + iovs, headers[n], frame, 0, queue->sequence + n);
+                frame_len[n] = wire_len(queue, frame);
+                total += frame_len[n];
+                iovs += k;
+                frames[n] = frame;
+                lane_of[n++] = lane;
+            }
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovs;
+        flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        if (zc != NULL && !copy && zc_want(zc, total, n))
+            flags |= MSG_ZEROCOPY;
+        if (ring != NULL)
+        {
+            sent = shm_putv(ring, iov, iovs);
+            if (sent == 0)
+            {
+                queue->blocked = 1;
+                return 0;
+            }
+        }
+        else
+        {
+            sent = sendmsg(sockfd, &msg, flags);
+        }
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            /* Out of pinnable memory, send this batch the ordinary way */
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+            {
+                copy = 1;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                queue->blocked = 1;
+                return 0;
+            }
+            return -1;
+        }
+
+        copy = 0;
+        if (flags & MSG_ZEROCOPY)
+        {
+            for (i = 0, len = 0; i < n && len < (size_t)sent; i++)
+                len += frame_len[i];
+            zc_track(zc, frames, i);
+        }
+
+        /* Release every frame that went out completely, in send order */
+        queue->bytes -= sent;
+        for (i = 0; i < n && sent > 0; i++)
+        {
+            len = frame_len[i];
+            if ((size_t)sent < len)
+            {
+                queue->partial_lane = lane_of[i];
+                queue->offset += sent;
+                break;
+            }
+            sent -= len;
+            queue->offset = 0;
+            queue->count--;
+            queue->sequence++;
+            frame_unref(lane_pop(&queue->lanes[lane_of[i]]));
+        }
+    }
+    queue->blocked = 0;
+    return 1;
+}
+
+void outq_clear(struct OutQueue *queue)
+{
+    int lane;
+
+    for (lane = 0; lane < OUTQ_LANES; lane++)
+    {
+        while (queue->lanes[lane].count > 0)
+            frame_unref(lane_pop(&queue->lanes[lane]));
+        free(queue->lanes[lane].frames);
+    }
+    memset(queue, 0, sizeof(*queue));
+}
@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "parser.h"
+
+/*
+ * Decode the frame at the start of buf. Returns the number of bytes it
+ * occupies once it is complete, 0 while more data is needed, or -1 if its
+ * length exceeds max_len and it can never fit the buffer.
+ */
+int frame_parse(const char *buf, size_t avail, size_t max_len, struct FrameView *view)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    uint32_t word;
+    uint32_t len;
+
+    if (avail < 4)
+        return 0;
+    word = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    len = word & FRAME_LENGTH_MASK;
+    if (len > max_len)
+        return -1;
+    if (avail - 4 < len)
+        return 0;
+
+    view->msg = buf + 4;
+    view->len = len;
+    view->flags = word & ~FRAME_LENGTH_MASK;
+    return 4 + len;
+}
+
+/*
+ * Drop the first consumed bytes of a buffer holding pos bytes, once per read
+ * rather than once per frame. Returns the bytes left.
+ */
+size_t frame_compact(char *buf, size_t pos, size_t consumed)
+{
+    if (consumed == 0)
+        return pos;
+    if (consumed < pos)
+        memmove(buf, buf + consumed, pos - consumed);
+    return pos - consumed;
+}
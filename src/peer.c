@@ -0,0 +1,123 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "peer.h"
+#include "daemonize.h"
+
+/* Parse a host:port endpoint, the host as a dotted quad */
+int peer_parse(struct PeerLink *link, const char *endpoint)
+{
+    char host[INET_ADDRSTRLEN];
+    const char *colon;
+
+    colon = strchr(endpoint, ':');
+    if (colon == NULL || colon - endpoint >= (int)sizeof(host))
+    {
+        syslog(LOG_ERR, "invalid peer %s\n", endpoint);
+        return -1;
+    }
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+
+    memset(link, 0, sizeof(*link));
+    link->addr.sin_family = AF_INET;
+    link->addr.sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &link->addr.sin_addr) != 1)
+    {
+        syslog(LOG_ERR, "invalid peer %s\n", endpoint);
+        return -1;
+    }
+    return 0;
+}
+
+/* Start connecting to a peer without blocking, returns the socket or -1 */
+int peer_dial(struct PeerLink *link)
+{
+    int sockfd;
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sockfd == -1)
+    {
+        syslog(LOG_ERR, "socket failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&link->addr, sizeof(link->addr)) == -1 && errno != EINPROGRESS)
+    {
+        syslog(LOG_ERR, "peer connect failed: %s (%d)\n", strerror(errno), errno);
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/*
+ * Finish a connect once the socket is writable. The socket stays
+ * non-blocking like every accepted one. Returns -1 if the connection failed.
+ */
+int peer_connected(int sockfd)
+{
+    socklen_t len = sizeof(int);
+    int error = 0;
+
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+        error = errno;
+    if (error != 0)
+    {
+        syslog(LOG_ERR, "peer connect failed: %s (%d)\n", strerror(error), error);
+        return -1;
+    }
+    return 0;
+}
+
+/* Schedule the next dial, backing off while the peer stays unreachable */
+void peer_retry(struct PeerLink *link, uint64_t now)
+{
+    link->client = NULL;
+    link->backoff = link->backoff == 0 ? PEER_RETRY_NS : link->backoff * 2;
+    if (link->backoff > PEER_RETRY_MAX_NS)
+        link->backoff = PEER_RETRY_MAX_NS;
+    link->retry_at = now + link->backoff;
+}
+
+/* Write an opcode and an 8-byte big-endian value as a control payload */
+static void put_control(char *msg, char opcode, uint64_t value)
+{
+    int i;
+
+    msg[0] = opcode;
+    for (i = 8; i > 0; i--)
+    {
+        msg[i] = value;
+        value >>= 8;
+    }
+}
+
+struct Frame *peer_hello(uint64_t node_id)
+{
+    struct Frame *frame;
+
+    frame = frame_alloc(9, FRAME_CONTROL | FRAME_PRIORITY);
+    if (frame == NULL)
+        return NULL;
+    put_control(frame->data + 4, CTRL_PEER_HELLO, node_id);
+    return frame;
+}
+
+/* Wrap a data frame for the mesh, keeping its priority */
+struct Frame *peer_wrap(const struct Frame *frame, uint64_t origin)
+{
+    struct Frame *wrapped;
+    uint32_t len = frame->len - 4;
+
+    wrapped = frame_alloc(9 + len, FRAME_CONTROL | (frame->flags & FRAME_PRIORITY));
+    if (wrapped == NULL)
+        return NULL;
+    put_control(wrapped->data + 4, CTRL_PEER_FRAME, origin);
+    memcpy(wrapped->data + 13, frame->data + 4, len);
+    return wrapped;
+}
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "pool.h"
+
+/* Size class of a block of at most POOL_MAX_BLOCK bytes */
+static int class_of(size_t size)
+{
+    int bits;
+
+    if (size <= 64)
+        return 0;
+    bits = 63 - __builtin_clzl(size - 1);
+    return (bits - 6) * 4 + (int)((size - 1) >> (bits - 2) & 3) + 1;
+}
+
+static size_t class_size(int class)
+{
+    if (class == 0)
+        return 64;
+    return (size_t)(5 + (class - 1) % 4) << ((class - 1) / 4 + 4);
+}
+
+/* Map size bytes aligned on a huge page, with huge pages if asked */
+static char *map_region(size_t size, int flags)
+{
+    char *base;
+    size_t head;
+
+    if (flags & POOL_HUGETLB)
+    {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED)
+            return base;
+        syslog(LOG_INFO, "no hugetlb pages for the pool, using transparent huge pages\n");
+        flags |= POOL_THP;
+    }
+
+    /* Over-allocate by one huge page and trim to an aligned region */
+    base = mmap(NULL, size + POOL_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    head = (POOL_HUGE_PAGE - (size_t)base % POOL_HUGE_PAGE) % POOL_HUGE_PAGE;
+    if (head > 0)
+        munmap(base, head);
+    munmap(base + head + size, POOL_HUGE_PAGE - head);
+    base += head;
+    if ((flags & POOL_THP) && madvise(base, size, MADV_HUGEPAGE) == -1)
+        syslog(LOG_INFO, "no transparent huge pages for the pool: %s (%d)\n", strerror(errno), errno);
+    return base;
+}
+
+/*
+ * A pool of size bytes on the calling thread's NUMA node. The binding is a
+ * preference, so a full node spills over instead of failing, and is made
+ * before any page is touched. Kernels without NUMA refuse it harmlessly.
+ */
+struct Pool *pool_new(size_t size, int flags)
+{
+    struct Pool *pool;
+    unsigned long mask;
+    unsigned int cpu;
+    unsigned int node;
+    size_t i;
+
+    pool = calloc(1, sizeof(struct Pool));
+    if (pool == NULL)
+        return NULL;
+    pool->size = (size + POOL_HUGE_PAGE - 1) / POOL_HUGE_PAGE * POOL_HUGE_PAGE;
+    pool->base = map_region(pool->size, flags);
+    if (pool->base == NULL)
+    {
+        syslog(LOG_ERR, "pool mmap failed: %s (%d)\n", strerror(errno), errno);
+        free(pool);
+        return NULL;
+    }
+
+    pool->node = -1;
+    if (getcpu(&cpu, &node) == 0 && node < sizeof(mask) * 8)
+    {
+        mask = 1ul << node;
+        if (syscall(SYS_mbind, pool->base, pool->size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) == 0)
+            pool->node = node;
+    }
+
+    if (flags & POOL_PREFAULT)
+    {
+        for (i = 0; i < pool->size; i += 4096)
+            pool->base[i] = 0;
+    }
+    return pool;
+}
+
+void *pool_alloc(struct Pool *pool, size_t size)
+{
+    size_t block;
+    void *p;
+    int class;
+
+    if (pool == NULL || size > POOL_MAX_BLOCK)
+        return malloc(size);
+    class = class_of(size);
+    p = pool->free[class];
+    if (p != NULL)
+        pool->free[class] = *(void **)p;
+    else
+    {
+        block = class_size(class);
+        if (pool->size - pool->used < block)
+            return malloc(size);
+        p = pool->base + pool->used;
+        pool->used += block;
+    }
+    pool->live++;
+    return p;
+}
+
+/* Return a block from pool_alloc() of the same size, whichever way it came */
+void pool_release(struct Pool *pool, void *block, size_t size)
+{
+    int class;
+
+    if (pool == NULL || (char *)block < pool->base || (char *)block >= pool->base + pool->size)
+    {
+        free(block);
+        return;
+    }
+    class = class_of(size);
+    *(void **)block = pool->free[class];
+    pool->free[class] = block;
+    if (--pool->live == 0 && pool->dead)
+    {
+        munmap(pool->base, pool->size);
+        free(pool);
+    }
+}
+
+/* Unmap the region now, or once the last block still out comes back */
+void pool_free(struct Pool *pool)
+{
+    if (pool == NULL)
+        return;
+    if (pool->live > 0)
+    {
+        pool->dead = 1;
+        return;
+    }
+    munmap(pool->base, pool->size);
+    free(pool);
+}
@@ -0,0 +1,11 @@
+#include "probes.h"
+
+#ifdef DAEMONIZE_USDT
+PROBE_SEMAPHORE(accept);
+PROBE_SEMAPHORE(frame);
+PROBE_SEMAPHORE(fanout_start);
+PROBE_SEMAPHORE(send);
+PROBE_SEMAPHORE(flush);
+PROBE_SEMAPHORE(fanout_end);
+PROBE_SEMAPHORE(disconnect);
+#endif
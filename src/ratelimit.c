@@ -0,0 +1,44 @@
+#include "ratelimit.h"
+
+void bucket_init(struct TokenBucket *bucket, double rate, uint64_t now)
+{
+    bucket->rate = rate;
+    bucket->burst = rate * RATE_BURST_MS / 1000;
+    if (bucket->burst < 1)
+        bucket->burst = 1;
+    bucket->tokens = bucket->burst;
+    bucket->last = now;
+}
+
+static void bucket_refill(struct TokenBucket *bucket, uint64_t now)
+{
+    if (now <= bucket->last)
+        return;
+    bucket->tokens += bucket->rate * (now - bucket->last) / 1e9;
+    if (bucket->tokens > bucket->burst)
+        bucket->tokens = bucket->burst;
+    bucket->last = now;
+}
+
+/* Whether the bucket is out of debt and may be charged again */
+int bucket_ready(struct TokenBucket *bucket, uint64_t now)
+{
+    if (bucket->rate == 0)
+        return 1;
+    bucket_refill(bucket, now);
+    return bucket->tokens > 0;
+}
+
+void bucket_charge(struct TokenBucket *bucket, double amount)
+{
+    if (bucket->rate != 0)
+        bucket->tokens -= amount;
+}
+
+/* Nanoseconds until the bucket is ready again */
+uint64_t bucket_wait(struct TokenBucket *bucket, uint64_t now)
+{
+    if (bucket_ready(bucket, now))
+        return 0;
+    return (uint64_t)(-bucket->tokens / bucket->rate * 1e9) + 1;
+}
@@ -0,0 +1,1943 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "daemonize.h"
+#include "relay.h"
+#include "udp.h"
+#include "parser.h"
+#include "journal.h"
+#include "frame.h"
+#include "outq.h"
+#include "lvc.h"
+#include "ratelimit.h"
+#include "probes.h"
+#include "flightrec.h"
+#include "capture.h"
+#include "looplag.h"
+#include "admin.h"
+#include "fanout.h"
+#include "fqueue.h"
+#include "zerocopy.h"
+#include "splice.h"
+#include "tls.h"
+#include "peer.h"
+#include "shm.h"
+
+/* Frames relayed from one client per loop iteration */
+#define READ_BUDGET 16
+/* Datagram batches relayed per wakeup */
+#define UDP_BUDGET 16
+/* Frames other threads may have posted and the loop not yet taken */
+#define INBOX_SIZE 4096
+/* Posted frames relayed per wakeup, taken INBOX_BATCH at a time */
+#define INBOX_BUDGET 256
+#define INBOX_BATCH 32
+/* How long queues may stay over the memory budget before clients are dropped */
+#define MEM_GRACE_NS 1000000000ull
+
+/* A client a large fan-out sends to from a sender thread, and how that went */
+struct FanoutSend
+{
+    struct ClientConnection *client;
+    ssize_t sent;
+    int flags;
+    int error;
+};
+
+/* One relay instance; every piece of state lives here, none is global */
+struct Relay
+{
+    struct RelayConfig config;
+    struct RelayHandler handler;
+    int server_socket;
+    int unix_socket;
+    struct ClientConnection *clients;
+    struct ClientConnection *rr_start;
+    int client_count;
+    struct UdpRelay *udp;
+    struct Journal *journal;
+    struct Capture *capture;
+    struct LoopLag *lag;
+    struct Fanout *senders;
+    struct FanoutSend *sends; /* One per client, grown as clients come */
+    size_t sends_size;
+    struct Frame *sending; /* The frame the senders are sending */
+    struct pollfd *polls; /* The pass's poll set, grown as clients come */
+    size_t polls_size;
+    int poll_count;
+    struct FrameQueue *inbox; /* Frames posted from other threads */
+    int inbox_efd;            /* Kicked by a poster that finds the loop asleep */
+    int inbox_sleeping;
+    struct Lvc *lvc;
+    struct SplicePipe scratch;
+    struct ssl_ctx_st *tls;
+    struct PeerLink peers[PEER_MAX];
+    struct Pool *pool;
+    struct RouteTable routes;
+    struct FrameMemory *frames; /* Frames queued, cached or pinned by zero-copy sends here, each counted once */
+    size_t memory;       /* Bytes held as of the start of this pass */
+    int shedding;        /* Over memLimit: no reads, no accepts, bulk frames dropped */
+    uint64_t shed_since;
+    uint64_t shed_drops;
+    uint64_t now;
+    volatile sig_atomic_t stop;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Charge the loop's time so far to the phase it leaves, when it is timed */
+static void lag_mark(struct Relay *relay, int phase)
+{
+    if (relay->lag != NULL)
+        lag_phase(relay->lag, phase, now_ns());
+}
+
+void relay_config_init(struct RelayConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->port = 8080;
+    config->maxClients = 10;
+}
+
+struct Relay *relay_new(const struct RelayConfig *config, const struct RelayHandler *handler)
+{
+    struct Relay *relay;
+
+    relay = calloc(1, sizeof(struct Relay));
+    if (relay == NULL)
+        return NULL;
+    if (route_init(&relay->routes) != 0)
+    {
+        free(relay);
+        return NULL;
+    }
+    relay->frames = frame_memory_new();
+    if (relay->frames == NULL)
+    {
+        route_free(&relay->routes);
+        free(relay);
+        return NULL;
+    }
+    relay->config = *config;
+    if (handler != NULL)
+        relay->handler = *handler;
+    relay->server_socket = -1;
+    relay->unix_socket = -1;
+    relay->inbox_efd = -1;
+    splice_pipe_init(&relay->scratch);
+    return relay;
+}
+
+/* Open the listening socket and every optional subsystem the config asks for */
+int relay_listen(struct Relay *relay)
+{
+    struct RelayConfig *config = &relay->config;
+    struct sockaddr_un unix_addr;
+    struct sockaddr_in addr;
+    int one = 1;
+    int i;
+
+    /* Create server socket */
+    relay->server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (relay->server_socket == -1)
+    {
+        syslog(LOG_ERR, "socket failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    setsockopt(relay->server_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    /* Accepted sockets inherit busy polling from the listener */
+    if (config->busyPollSocket > 0 &&
+        setsockopt(relay->server_socket, SOL_SOCKET, SO_BUSY_POLL, &config->busyPollSocket, sizeof(int)) == -1)
+        syslog(LOG_ERR, "SO_BUSY_POLL failed: %s (%d)\n", strerror(errno), errno);
+
+    /* Bind to port */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(config->port);
+    if (bind(relay->server_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        syslog(LOG_ERR, "bind failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+
+    /* Listen */
+    if (listen(relay->server_socket, SOMAXCONN) == -1)
+    {
+        syslog(LOG_ERR, "listen failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+
+    /* Unix socket for shared memory clients, replacing a stale one */
+    if (config->unixPath != NULL)
+    {
+        memset(&unix_addr, 0, sizeof(unix_addr));
+        unix_addr.sun_family = AF_UNIX;
+        if (strlen(config->unixPath) >= sizeof(unix_addr.sun_path))
+        {
+            syslog(LOG_ERR, "unix socket path too long\n");
+            return -1;
+        }
+        strcpy(unix_addr.sun_path, config->unixPath);
+        unlink(config->unixPath);
+        relay->unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (relay->unix_socket == -1 || bind(relay->unix_socket, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) == -1 ||
+            listen(relay->unix_socket, SOMAXCONN) == -1)
+        {
+            syslog(LOG_ERR, "unix socket failed: %s (%d)\n", strerror(errno), errno);
+            return -1;
+        }
+    }
+
+    /* Datagram relay */
+    if (config->udpPort != 0)
+    {
+        relay->udp = (struct UdpRelay *)malloc(sizeof(struct UdpRelay));
+        if (relay->udp == NULL || udp_open(relay->udp, config->udpPort, config->udpGroup) != 0)
+            return -1;
+        for (i = 0; i < config->udpSubscriberCount; i++)
+        {
+            if (udp_add_subscriber(relay->udp, config->udpSubscribers[i]) != 0)
+                return -1;
+        }
+        if (config->busyPollSocket > 0)
+            setsockopt(relay->udp->sock, SOL_SOCKET, SO_BUSY_POLL, &config->busyPollSocket, sizeof(int));
+    }
+
+    /* Frame journal */
+    if (config->journalDir != NULL)
+    {
+        relay->journal = (struct Journal *)malloc(sizeof(struct Journal));
+        if (relay->journal == NULL || journal_open(relay->journal, config->journalDir) != 0)
+            return -1;
+    }
+
+    /* Traffic capture */
+    if (config->captureFile != NULL)
+    {
+        relay->capture = (struct Capture *)malloc(sizeof(struct Capture));
+        if (relay->capture == NULL || capture_open(relay->capture, config->captureFile, now_ns()) != 0)
+        {
+            free(relay->capture);
+            relay->capture = NULL;
+            return -1;
+        }
+    }
+
+    /* TLS listener */
+    if (config->tlsCert != NULL)
+    {
+        relay->tls = tls_server_new(config->tlsCert, config->tlsKey);
+        if (relay->tls == NULL)
+            return -1;
+    }
+
+    /* Peer mesh, the links are dialed from the event loop */
+    if (config->nodeId != 0 && relay->tls != NULL)
+    {
+        syslog(LOG_ERR, "peer links do not support TLS\n");
+        return -1;
+    }
+    for (i = 0; i < config->peerCount; i++)
+    {
+        if (config->nodeId == 0)
+        {
+            syslog(LOG_ERR, "peers need a node id\n");
+            return -1;
+        }
+        if (peer_parse(&relay->peers[i], config->peers[i]) != 0)
+            return -1;
+    }
+
+    /* Last-value cache for conflation */
+    if (config->conflate)
+    {
+        relay->lvc = (struct Lvc *)malloc(sizeof(struct Lvc));
+        if (relay->lvc == NULL || lvc_init(relay->lvc, LVC_CAPACITY) != 0)
+            return -1;
+    }
+
+    /* Loop timing, with a watchdog for passes that get stuck */
+    if (config->lagThreshold > 0)
+    {
+        relay->lag = (struct LoopLag *)malloc(sizeof(struct LoopLag));
+        if (relay->lag == NULL || lag_start(relay->lag, (uint64_t)config->lagThreshold * 1000000) != 0)
+        {
+            free(relay->lag);
+            relay->lag = NULL;
+            return -1;
+        }
+        admin_add_metrics(lag_metrics, relay->lag);
+    }
+
+    /* Inbox for frames posted from other threads */
+    relay->inbox = aligned_alloc(64, sizeof(struct FrameQueue));
+    if (relay->inbox == NULL || fq_init(relay->inbox, INBOX_SIZE, FQ_SINGLE_CONSUMER) != 0)
+    {
+        free(relay->inbox);
+        relay->inbox = NULL;
+        return -1;
+    }
+    relay->inbox_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (relay->inbox_efd == -1)
+    {
+        syslog(LOG_ERR, "eventfd failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+
+    /* Sender threads for large fan-outs */
+    if (config->senderThreads > 0)
+    {
+        relay->senders = (struct Fanout *)malloc(sizeof(struct Fanout));
+        if (relay->senders == NULL || fanout_start(relay->senders, config->senderThreads) != 0)
+        {
+            free(relay->senders);
+            relay->senders = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int deliver(struct Relay *relay, struct ClientConnection *client, struct Frame *frame, int slot);
+static void relay_frame(struct Relay *relay, struct ClientConnection *sender, struct Frame *frame);
+
+/* The dialed link that client is, if any */
+static struct PeerLink *find_link(struct Relay *relay, struct ClientConnection *client)
+{
+    int i;
+
+    for (i = 0; i < relay->config.peerCount; i++)
+    {
+        if (relay->peers[i].client == client)
+            return &relay->peers[i];
+    }
+    return NULL;
+}
+
+/*
+ * Take a peer's hello: client links this node to node_id from now on. An
+ * accepted link answers with this node's own hello. Two nodes that dial
+ * each other end up with two links; frames take the first of them and the
+ * second stands by until the first fails.
+ */
+static void link_peer(struct Relay *relay, struct ClientConnection *client, uint64_t node_id)
+{
+    struct ClientConnection *other;
+    struct PeerLink *link;
+    struct Frame *hello;
+
+    if (relay->config.nodeId == 0 || node_id == 0 || node_id == relay->config.nodeId || client->peer_id != 0)
+    {
+        syslog(LOG_ERR, "unexpected hello from node %llu\n", (unsigned long long)node_id);
+        client->closing = 1;
+        return;
+    }
+
+    if (client->peer == PEER_NONE)
+    {
+        client->peer = PEER_ACCEPTED;
+        /* Links never get cached values, a snapshot already sent is ignored */
+        conflate_clear(&client->conflate);
+        hello = peer_hello(relay->config.nodeId);
+        if (hello == NULL)
+        {
+            client->closing = 1;
+            return;
+        }
+        deliver(relay, client, hello, -1);
+        frame_unref(hello);
+    }
+    else if ((link = find_link(relay, client)) != NULL)
+    {
+        link->backoff = 0;
+    }
+
+    for (other = relay->clients; other != NULL; other = other->next)
+    {
+        if (other != client && other->peer_id == node_id && !other->peer_standby && !other->closing)
+            break;
+    }
+    client->peer_id = node_id;
+    client->peer_standby = other != NULL;
+    syslog(LOG_INFO, "linked to node %llu\n", (unsigned long long)node_id);
+}
+
+/* Relay a frame another node's client sent to this node's clients */
+static void relay_peer_frame(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view, uint64_t origin)
+{
+    struct Frame *frame;
+
+    if (client->peer_id == 0)
+    {
+        syslog(LOG_ERR, "peer frame from a client that is not a peer\n");
+        return;
+    }
+    /* A frame of this node's own that came back round */
+    if (origin == relay->config.nodeId)
+        return;
+
+    frame = frame_new_in(relay->pool, view->msg + 9, view->len - 9, view->flags & FRAME_PRIORITY);
+    if (frame == NULL)
+    {
+        syslog(LOG_ERR, "frame allocation failed, frame dropped\n");
+        return;
+    }
+    relay_frame(relay, client, frame);
+    frame_unref(frame);
+}
+
+/* Give up capturing after a write error, the relay itself carries on */
+static void stop_capture(struct Relay *relay)
+{
+    syslog(LOG_ERR, "capture stopped\n");
+    capture_close(relay->capture);
+    free(relay->capture);
+    relay->capture = NULL;
+}
+
+/* Pass a CTRL_ROUTE frame to the one client it is addressed to */
+static void route_frame(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view, uint64_t target_id)
+{
+    struct ClientConnection *target;
+    struct Frame *frame;
+
+    if (view->len < 17)
+    {
+        syslog(LOG_ERR, "short route frame\n");
+        return;
+    }
+    /* Ids are local to this node, links and unannounced clients are not addressable */
+    target = route_find(&relay->routes, target_id);
+    if (target != NULL && (target->closing || target->peer != PEER_NONE || target->handshaking || target->connecting))
+        target = NULL;
+    if (target == NULL)
+    {
+        flightrec_record(FR_ERROR, client->socket, EHOSTUNREACH, __LINE__, relay->now);
+        frame = route_unreachable(relay->pool, view);
+        target = client;
+    }
+    else
+        frame = route_forward(relay->pool, view, client->id);
+    if (frame == NULL)
+    {
+        syslog(LOG_ERR, "frame allocation failed, frame dropped\n");
+        return;
+    }
+    deliver(relay, target, frame, -1);
+    frame_unref(frame);
+}
+
+/* Serve a control frame sent by a client to the daemon itself */
+static void handle_control(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view)
+{
+    const char *msg = view->msg;
+    struct Frame *frame;
+    uint64_t value = 0;
+    int i;
+
+    if (view->len < 9)
+    {
+        syslog(LOG_ERR, "short control frame\n");
+        return;
+    }
+    for (i = 1; i < 9; i++)
+        value = (value << 8) | (msg[i] & 0xff);
+
+    switch (msg[0])
+    {
+    case CTRL_REPLAY_SEQ:
+    case CTRL_REPLAY_TIME:
+        if (relay->journal == NULL)
+        {
+            syslog(LOG_ERR, "replay requested but journal is disabled\n");
+            return;
+        }
+        /* Replays are sent from the page cache to the socket, as journaled */
+        if (client->shm != NULL || relay->config.wire != WIRE_LEGACY)
+        {
+            syslog(LOG_ERR, "replay requested over shared memory or another framing\n");
+            return;
+        }
+        /* Started by serve_client() once nothing else is on its way to the client */
+        client->replay_op = msg[0];
+        client->replay_from = value;
+        break;
+    case CTRL_PEER_HELLO:
+        link_peer(relay, client, value);
+        break;
+    case CTRL_PEER_FRAME:
+        relay_peer_frame(relay, client, view, value);
+        break;
+    case CTRL_ROUTE:
+        route_frame(relay, client, view, value);
+        break;
+    case CTRL_CLIENT_ID:
+        frame = route_client_id(relay->pool, client->id);
+        if (frame != NULL)
+        {
+            deliver(relay, client, frame, -1);
+            frame_unref(frame);
+        }
+        break;
+    default:
+        syslog(LOG_ERR, "unknown control opcode %d\n", msg[0]);
+        break;
+    }
+}
+
+static int queue_frame(struct Relay *relay, struct ClientConnection *client, struct Frame *frame, size_t offset)
+{
+    int lane = (frame->flags & FRAME_PRIORITY) ? OUTQ_HIGH : OUTQ_LOW;
+
+    if (client->outq.count == 0)
+        client->outq.since = relay->now;
+    if (outq_push(&client->outq, frame, offset, lane) != 0)
+    {
+        syslog(LOG_ERR, "slow consumer, outbound queue full\n");
+        flightrec_record(FR_ERROR, client->socket, ENOBUFS, __LINE__, relay->now);
+        return -1;
+    }
+    frame_charge(frame, relay->frames);
+    return 0;
+}
+
+/* Whether anything is waiting to be written to a client */
+static int pending(struct ClientConnection *client)
+{
+    return client->outq.count > 0 || client->conflate.count > 0 || client->out_pipe.bytes > 0;
+}
+
+/* Memory a client pins: its connection, conflation set, queued frames and pipes */
+static size_t client_memory(struct Relay *relay, struct ClientConnection *client)
+{
+    size_t bytes = sizeof(struct ClientConnection) + client->outq.bytes + client->in_pipe.bytes + client->out_pipe.bytes;
+
+    if (client->conflate.ring != NULL)
+        bytes += (relay->lvc->mask + 1) * sizeof(uint32_t) + (relay->lvc->mask + 1) / 8;
+    if (client->shm != NULL)
+        bytes += client->shm->map_size;
+    return bytes;
+}
+
+/* Whether a client holds more than its own budget allows */
+static int client_over_budget(struct Relay *relay, struct ClientConnection *client)
+{
+    return relay->config.clientMemLimit > 0 && client_memory(relay, client) > relay->config.clientMemLimit;
+}
+
+/*
+ * Total what the relay holds and shed load while it is over budget. At
+ * first reads and accepts pause and bulk frames for lagging clients are
+ * dropped, so queues can only shrink; if they have not drained below the
+ * budget within MEM_GRACE_NS, the client holding most is dropped, one per
+ * pass. Shedding ends once usage is an eighth below the budget.
+ */
+static void account_memory(struct Relay *relay)
+{
+    size_t limit = relay->config.memLimit;
+    struct ClientConnection *client;
+    struct ClientConnection *hog = NULL;
+    size_t hog_bytes = 0;
+    size_t bytes;
+
+    /* Queued frames are shared between clients, so they are counted once */
+    relay->memory = frame_memory(relay->frames);
+    if (relay->lvc != NULL)
+        relay->memory += (relay->lvc->mask + 1) * sizeof(struct LvcSlot);
+    for (client = relay->clients; client != NULL; client = client->next)
+    {
+        bytes = client_memory(relay, client);
+        relay->memory += bytes - client->outq.bytes;
+        if (bytes > hog_bytes && !client->closing)
+        {
+            hog = client;
+            hog_bytes = bytes;
+        }
+    }
+    if (limit == 0)
+        return;
+
+    if (!relay->shedding && relay->memory > limit)
+    {
+        syslog(LOG_ERR, "memory budget exceeded, %zu bytes in use, shedding load\n", relay->memory);
+        relay->shedding = 1;
+        relay->shed_since = relay->now;
+        relay->shed_drops = 0;
+    }
+    else if (relay->shedding && relay->memory <= limit - limit / 8)
+    {
+        syslog(LOG_INFO, "memory back within budget, %llu frames dropped\n", (unsigned long long)relay->shed_drops);
+        relay->shedding = 0;
+    }
+    else if (relay->shedding && relay->memory > limit && relay->now - relay->shed_since >= MEM_GRACE_NS && hog != NULL)
+    {
+        syslog(LOG_ERR, "memory budget exceeded, dropping client holding %zu bytes\n", hog_bytes);
+        flightrec_record(FR_ERROR, hog->socket, ENOMEM, __LINE__, relay->now);
+        hog->closing = 1;
+    }
+}
+
+/*
+ * Drain a lagging client: the rest of a spliced frame first, then queued
+ * frames, then the newest value of each key it missed. Returns 1 when
+ * nothing is left, 0 if the socket filled up, -1 on error.
+ */
+static int flush_client(struct Relay *relay, struct ClientConnection *client)
+{
+    struct Lvc *lvc = relay->lvc;
+    int result;
+    int slot;
+
+    if (client->out_pipe.bytes > 0)
+    {
+        result = splice_out(&client->out_pipe, client->socket);
+        PROBE3(flush, client->socket, result, client->out_pipe.bytes);
+        flightrec_record(FR_FLUSH, client->socket, result, client->out_pipe.bytes, relay->now);
+        if (result != 1)
+            return result;
+    }
+    for (;;)
+    {
+        result = outq_flush(&client->outq, client->socket, &client->zc, client->shm != NULL ? &client->shm->out : NULL);
+        PROBE3(flush, client->socket, result, client->outq.bytes);
+        flightrec_record(FR_FLUSH, client->socket, result, client->outq.bytes, relay->now);
+        if (result != 1 || client->conflate.count == 0)
+            return result;
+        while (client->outq.count < OUTQ_IOV && (slot = conflate_pop(&client->conflate, lvc)) >= 0)
+        {
+            if (outq_push(&client->outq, lvc->slots[slot].value, 0, OUTQ_LOW) != 0)
+                return -1;
+        }
+    }
+}
+
+/*
+ * Write a whole frame to a client with nothing queued. Stores what went out
+ * in sent, -1 with errno set on error, and returns the send flags. Touches
+ * nothing but the client, so a sender thread may call it.
+ */
+static int send_frame(struct Relay *relay, struct ClientConnection *client, struct Frame *frame, ssize_t *sent)
+{
+    int flags;
+
+    /* Large frames leave without a copy, held until the kernel is done */
+    flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    if (zc_want(&client->zc, frame->len, 1))
+        flags |= MSG_ZEROCOPY;
+    if (client->shm != NULL)
+        *sent = shm_put(&client->shm->out, frame->data, frame->len);
+    else
+        *sent = send(client->socket, frame->data, frame->len, flags);
+    if (*sent < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+    {
+        flags &= ~MSG_ZEROCOPY;
+        *sent = send(client->socket, frame->data, frame->len, flags);
+    }
+    PROBE3(send, client->socket, frame->len, *sent);
+    flightrec_record(FR_SEND, client->socket, frame->len, *sent, relay->now);
+    return flags;
+}
+
+/* Settle a send_frame() on the loop thread: hold the frame for what is left */
+static void sent_frame(struct Relay *relay, struct ClientConnection *client, struct Frame *frame, ssize_t sent, int flags, int error)
+{
+    if (sent < 0)
+    {
+        if (error != EINTR && error != EAGAIN && error != EWOULDBLOCK)
+        {
+            client->closing = 1;
+            return;
+        }
+        sent = 0;
+    }
+    else if (flags & MSG_ZEROCOPY)
+    {
+        zc_track(&client->zc, &frame, 1);
+        frame_charge(frame, relay->frames);
+    }
+    if ((size_t)sent < frame->len)
+    {
+        client->outq.blocked = 1;
+        if (queue_frame(relay, client, frame, sent) != 0)
+            client->closing = 1;
+    }
+}
+
+/*
+ * Hand frame to one client. A client with nothing pending gets it straight
+ * away, or queued behind the coalescing window if one is set. A lagging
+ * client gets it queued or, for a keyed frame in conflation mode, only gets
+ * the key marked, so that it is sent the newest value once it catches up.
+ * Priority frames skip the window and overtake queued bulk frames. While
+ * the relay or the client is over its memory budget, bulk frames that would
+ * have to be queued are dropped instead; returns -1 if the frame was.
+ */
+static int deliver(struct Relay *relay, struct ClientConnection *client, struct Frame *frame, int slot)
+{
+    const struct OutqWindow *window = &relay->config.window;
+    int priority = (frame->flags & FRAME_PRIORITY) != 0;
+    ssize_t sent;
+    int flags;
+
+    /* A replaying client gets the rest once the journal stream is done */
+    if (pending(client) || client->replaying || (window->ns > 0 && !priority))
+    {
+        if (slot >= 0 && pending(client))
+        {
+            if (conflate_mark(&client->conflate, relay->lvc, slot) != 0)
+                client->closing = 1;
+        }
+        else if (!priority && (relay->shedding || client_over_budget(relay, client)))
+        {
+            relay->shed_drops++;
+            return -1;
+        }
+        else if (queue_frame(relay, client, frame, 0) != 0)
+        {
+            client->closing = 1;
+            return 0;
+        }
+
+        /* A full window or a priority frame leaves without waiting */
+        if (!client->outq.blocked && !client->replaying && (priority || client->outq.bytes >= window->bytes) &&
+            flush_client(relay, client) < 0)
+            client->closing = 1;
+        return 0;
+    }
+
+    /* Other framings get their headers written by the queue */
+    if (client->outq.wire != WIRE_LEGACY)
+    {
+        if (queue_frame(relay, client, frame, 0) != 0 || flush_client(relay, client) < 0)
+            client->closing = 1;
+        return 0;
+    }
+
+    flags = send_frame(relay, client, frame, &sent);
+    sent_frame(relay, client, frame, sent, flags, sent < 0 ? errno : 0);
+    return 0;
+}
+
+static void send_chunk(void *arg, size_t begin, size_t end)
+{
+    struct Relay *relay = arg;
+    struct FanoutSend *send;
+
+    for (send = relay->sends + begin; send < relay->sends + end; send++)
+    {
+        send->flags = send_frame(relay, send->client, relay->sending, &send->sent);
+        send->error = send->sent < 0 ? errno : 0;
+    }
+}
+
+/* Whether a fan-out may hand a client to the senders, a client deliver() would send to at once */
+static int may_send_now(struct Relay *relay, struct ClientConnection *client, struct Frame *frame)
+{
+    return !pending(client) && (relay->config.window.ns == 0 || (frame->flags & FRAME_PRIORITY)) &&
+           client->outq.wire == WIRE_LEGACY && client->shm == NULL;
+}
+
+/* Relay frame to every client but its sender */
+static void fan_out(struct Relay *relay, struct ClientConnection *sender, struct Frame *frame, int slot)
+{
+    struct ClientConnection *client;
+    struct FanoutSend *sends;
+    int parallel = 0;
+    int recipients = 0;
+    size_t count = 0;
+    size_t i;
+
+    PROBE3(fanout_start, sender != NULL ? sender->socket : -1, frame->len, probe_clock());
+
+    /* Enough clients to share out among the sender threads */
+    if (relay->senders != NULL && relay->client_count > FANOUT_CHUNK)
+    {
+        parallel = 1;
+        if (relay->sends_size < (size_t)relay->client_count)
+        {
+            sends = realloc(relay->sends, relay->client_count * sizeof(struct FanoutSend));
+            if (sends != NULL)
+            {
+                relay->sends = sends;
+                relay->sends_size = relay->client_count;
+            }
+            else
+                parallel = 0;
+        }
+    }
+
+    for (client = relay->clients; client != NULL; client = client->next)
+    {
+        /* Replaying clients pick live frames up from the journal, links get peer frames */
+        if (client == sender || client->replaying || client->closing || client->handshaking || client->peer != PEER_NONE)
+            continue;
+        recipients++;
+        /* Anything but a plain send stays on this thread, it may touch the frame's count or the pool */
+        if (parallel && may_send_now(relay, client, frame))
+            relay->sends[count++].client = client;
+        else
+            deliver(relay, client, frame, slot);
+    }
+
+    if (count > 0)
+    {
+        relay->sending = frame;
+        if (count > FANOUT_CHUNK)
+            fanout_run(relay->senders, count, send_chunk, relay);
+        else
+            send_chunk(relay, 0, count);
+        relay->sending = NULL;
+        for (i = 0; i < count; i++)
+            sent_frame(relay, relay->sends[i].client, frame, relay->sends[i].sent, relay->sends[i].flags, relay->sends[i].error);
+    }
+    PROBE3(fanout_end, sender != NULL ? sender->socket : -1, recipients, probe_clock());
+}
+
+/* Send a frame of this node's own clients once to every node linked to it */
+static void forward(struct Relay *relay, struct Frame *frame)
+{
+    struct ClientConnection *client;
+    struct Frame *wrapped = NULL;
+
+    for (client = relay->clients; client != NULL; client = client->next)
+    {
+        if (client->peer_id == 0 || client->peer_standby || client->closing)
+            continue;
+        if (wrapped == NULL)
+        {
+            /* The origin id must fit in the peer's receive buffer too */
+            if (frame->len + 9 > FRAME_BUFFER_SIZE)
+            {
+                syslog(LOG_ERR, "frame too long to forward to peers\n");
+                return;
+            }
+            wrapped = peer_wrap(frame, relay->config.nodeId);
+            if (wrapped == NULL)
+            {
+                syslog(LOG_ERR, "frame allocation failed, frame not forwarded\n");
+                return;
+            }
+        }
+        deliver(relay, client, wrapped, -1);
+    }
+    frame_unref(wrapped);
+}
+
+/* Journal, cache and fan out one data frame, and forward it if it is local */
+static void relay_frame(struct Relay *relay, struct ClientConnection *sender, struct Frame *frame)
+{
+    int slot;
+
+    /* Journal before fan-out so replays never miss a frame */
+    if (relay->journal != NULL && journal_append(relay->journal, frame->data + 4, frame->len - 4, frame->flags) != 0)
+        syslog(LOG_ERR, "journal append failed\n");
+
+    slot = relay->lvc != NULL && !(frame->flags & FRAME_PRIORITY) ? lvc_put(relay->lvc, frame) : -1;
+    if (slot >= 0)
+        frame_charge(frame, relay->frames);
+    fan_out(relay, sender, frame, slot);
+    if (relay->config.nodeId != 0 && (sender == NULL || sender->peer == PEER_NONE))
+        forward(relay, frame);
+}
+
+/* Copy the frame waiting in sender's pipe into a frame, leaving the pipe as is */
+static struct Frame *splice_frame(struct Relay *relay, struct ClientConnection *sender)
+{
+    size_t len = sender->in_pipe.bytes;
+    struct Frame *frame;
+
+    frame = frame_alloc_in(relay->pool, len, sender->splice_flags);
+    if (frame == NULL)
+        return NULL;
+    if (splice_pipe_open(&relay->scratch) != 0 || splice_tee(&sender->in_pipe, &relay->scratch, len) != 0 ||
+        splice_read(&relay->scratch, frame->data + 4, len) != 0)
+    {
+        splice_pipe_close(&relay->scratch);
+        frame_unref(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+/*
+ * Hand client the frame in sender's pipe, duplicated by tee or moved. The
+ * pipe is spliced to the socket by flush_client() once poll reports the
+ * socket writable.
+ */
+static void splice_send(struct Relay *relay, struct ClientConnection *client, struct ClientConnection *sender, const char *header, int move)
+{
+    struct SplicePipe *pipe = &client->out_pipe;
+    size_t len = sender->in_pipe.bytes;
+
+    if (splice_pipe_open(pipe) != 0 || splice_put(pipe, header, 4) != 0 ||
+        (move ? splice_move(&sender->in_pipe, pipe, len) : splice_tee(&sender->in_pipe, pipe, len)) != 0)
+    {
+        syslog(LOG_ERR, "splice failed: %s (%d)\n", strerror(errno), errno);
+        flightrec_record(FR_ERROR, client->socket, errno, __LINE__, relay->now);
+        client->closing = 1;
+    }
+}
+
+/*
+ * Relay the frame that arrived in sender's pipe. Every recipient with
+ * nothing pending gets the pipe's pages duplicated into its own pipe and
+ * spliced to its socket, the last of them takes the originals. A lagging
+ * recipient, one behind a coalescing window or one on shared memory needs
+ * the frame in memory, so the payload is copied out once for all of them.
+ */
+static void splice_fan_out(struct Relay *relay, struct ClientConnection *sender)
+{
+    struct ClientConnection *client;
+    struct ClientConnection *last = NULL;
+    struct Frame *frame = NULL;
+    uint32_t word = sender->in_pipe.bytes | sender->splice_flags;
+    char header[4];
+    int recipients = 0;
+
+    header[0] = word >> 24;
+    header[1] = word >> 16;
+    header[2] = word >> 8;
+    header[3] = word;
+
+    PROBE3(fanout_start, sender->socket, 4 + sender->in_pipe.bytes, probe_clock());
+    for (client = relay->clients; client != NULL; client = client->next)
+    {
+        if (client == sender || client->replaying || client->closing || client->handshaking || client->peer != PEER_NONE)
+            continue;
+        recipients++;
+
+        if (pending(client) || client->shm != NULL ||
+            (relay->config.window.ns > 0 && !(sender->splice_flags & FRAME_PRIORITY)))
+        {
+            if (frame == NULL)
+                frame = splice_frame(relay, sender);
+            if (frame == NULL)
+            {
+                syslog(LOG_ERR, "frame allocation failed, frame dropped\n");
+                continue;
+            }
+            deliver(relay, client, frame, -1);
+            continue;
+        }
+        if (last != NULL)
+            splice_send(relay, last, sender, header, 0);
+        last = client;
+    }
+
+    if (last != NULL)
+        splice_send(relay, last, sender, header, 1);
+    else
+        splice_pipe_close(&sender->in_pipe); /* Nobody took the original pages */
+    frame_unref(frame);
+    PROBE3(fanout_end, sender->socket, recipients, probe_clock());
+}
+
+/*
+ * Start passing a large frame through a pipe once its length word is in but
+ * its payload is not: what already arrived goes into the pipe and the rest
+ * is spliced from the socket as it comes. Only plain pass-through relays
+ * qualify, as the journal, the cache, on_frame and peers need the payload
+ * in memory. Returns 1 if the frame was taken, 0 if not, -1 on error.
+ */
+static int splice_start(struct Relay *relay, struct ClientConnection *client, const char *buf, size_t avail)
+{
+    uint32_t word;
+    uint32_t len;
+
+    if (relay->config.spliceMin == 0 || relay->journal != NULL || relay->lvc != NULL || relay->capture != NULL ||
+        relay->handler.on_frame != NULL || relay->config.nodeId != 0 || relay->config.wire != WIRE_LEGACY || avail < 4 ||
+        client->splice_refused)
+        return 0;
+    word = (uint32_t)(buf[0] & 0xff) << 24 | (buf[1] & 0xff) << 16 | (buf[2] & 0xff) << 8 | (buf[3] & 0xff);
+    len = word & FRAME_LENGTH_MASK;
+    if ((word & FRAME_CONTROL) || len < relay->config.spliceMin || len > sizeof(client->buffer) - 4)
+        return 0;
+
+    if (splice_pipe_open(&client->in_pipe) != 0 || splice_put(&client->in_pipe, buf + 4, avail - 4) != 0)
+        return -1;
+    client->splice_flags = word & ~FRAME_LENGTH_MASK;
+    client->splice_left = len - (avail - 4);
+
+    PROBE4(frame, client->socket, len, client->splice_flags, probe_clock());
+    flightrec_record(FR_FRAME, client->socket, len, client->splice_flags, relay->now);
+    bucket_charge(&client->frame_bucket, 1);
+    bucket_charge(&client->byte_bucket, 4 + len);
+    return 1;
+}
+
+/*
+ * Take back a frame whose pipe filled up before all of it arrived, as one
+ * can when F_SETPIPE_SZ was refused: what the pipe holds goes back into the
+ * client's buffer behind its length word and the rest is read into the
+ * buffer like any other frame. splice_start() made sure it fits.
+ */
+static int splice_refuse(struct ClientConnection *client)
+{
+    size_t len = client->in_pipe.bytes;
+    uint32_t word = (uint32_t)(len + client->splice_left) | client->splice_flags;
+
+    client->buffer[0] = word >> 24;
+    client->buffer[1] = word >> 16;
+    client->buffer[2] = word >> 8;
+    client->buffer[3] = word;
+    if (splice_read(&client->in_pipe, client->buffer + 4, len) != 0)
+        return -1;
+    splice_pipe_close(&client->in_pipe);
+    client->pos = 4 + len;
+    client->splice_left = 0;
+    client->splice_refused = 1;
+    return 0;
+}
+
+int relay_broadcast_frame(struct Relay *relay, struct ClientConnection *sender, struct Frame *frame)
+{
+    relay->now = now_ns();
+    relay_frame(relay, sender, frame);
+    return 0;
+}
+
+int relay_broadcast(struct Relay *relay, struct ClientConnection *sender, const char *msg, uint32_t len, uint32_t flags)
+{
+    struct Frame *frame;
+
+    if (len > FRAME_LENGTH_MASK)
+        return -1;
+    frame = frame_new_in(relay->pool, msg, len, flags & ~FRAME_LENGTH_MASK);
+    if (frame == NULL)
+        return -1;
+    relay_broadcast_frame(relay, sender, frame);
+    frame_unref(frame);
+    return 0;
+}
+
+/* Queue frame for one client only, bypassing journal and cache */
+int relay_send_frame(struct Relay *relay, struct ClientConnection *client, struct Frame *frame)
+{
+    if (client->closing || client->handshaking || client->connecting)
+        return -1;
+    relay->now = now_ns();
+    if (deliver(relay, client, frame, -1) != 0)
+        return -1;
+    return client->closing ? -1 : 0;
+}
+
+int relay_send(struct Relay *relay, struct ClientConnection *client, const char *msg, uint32_t len, uint32_t flags)
+{
+    struct Frame *frame;
+    int result;
+
+    if (len > FRAME_LENGTH_MASK)
+        return -1;
+    frame = frame_new_in(relay->pool, msg, len, flags & ~FRAME_LENGTH_MASK);
+    if (frame == NULL)
+        return -1;
+    result = relay_send_frame(relay, client, frame);
+    frame_unref(frame);
+    return result;
+}
+
+/*
+ * Hand frames from any thread to the loop, to be relayed like
+ * relay_broadcast_frame() with no sender. The loop is only woken if it was
+ * about to sleep, so a burst costs one eventfd write at most.
+ */
+unsigned int relay_post(struct Relay *relay, struct Frame *const *frames, unsigned int count)
+{
+    uint64_t one = 1;
+    unsigned int posted;
+
+    if (relay->inbox == NULL || count == 0)
+        return 0;
+    posted = fq_push(relay->inbox, frames, count);
+    if (posted == 0)
+        return 0;
+
+    /* Pairs with the fence in relay_run_once(): one side sees the other */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&relay->inbox_sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&relay->inbox_sleeping, 0, __ATOMIC_RELAXED) &&
+        write(relay->inbox_efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        syslog(LOG_ERR, "eventfd write failed: %s (%d)\n", strerror(errno), errno);
+    return posted;
+}
+
+/* Relay what other threads posted, at most INBOX_BUDGET frames */
+static void take_posted(struct Relay *relay)
+{
+    struct Frame *frames[INBOX_BATCH];
+    unsigned int taken;
+    unsigned int i;
+    int budget;
+
+    for (budget = INBOX_BUDGET; budget > 0; budget -= INBOX_BATCH)
+    {
+        taken = fq_pop(relay->inbox, frames, INBOX_BATCH);
+        for (i = 0; i < taken; i++)
+        {
+            relay_frame(relay, NULL, frames[i]);
+            frame_unref(frames[i]);
+        }
+        if (taken < INBOX_BATCH)
+            break;
+    }
+}
+
+/* The client is dropped at the end of the current loop iteration */
+void relay_close(struct Relay *relay, struct ClientConnection *client)
+{
+    (void)relay;
+    client->closing = 1;
+}
+
+/* Relay a data frame read from client */
+static void relay_data(struct Relay *relay, struct ClientConnection *client, const struct FrameView *view)
+{
+    struct Frame *frame;
+
+    frame = frame_new_in(relay->pool, view->msg, view->len, view->flags);
+    if (frame == NULL)
+    {
+        syslog(LOG_ERR, "frame allocation failed, frame dropped\n");
+        return;
+    }
+    relay_frame(relay, client, frame);
+    frame_unref(frame);
+}
+
+/* Whether a client is within its frame and byte rate limits */
+static int may_read(struct ClientConnection *client, uint64_t now)
+{
+    return bucket_ready(&client->frame_bucket, now) && bucket_ready(&client->byte_bucket, now);
+}
+
+/* Close a client and unlink it from the relay's list */
+static void drop_client(struct Relay *relay, struct ClientConnection *client)
+{
+    struct ClientConnection *other;
+    struct PeerLink *link;
+
+    PROBE2(disconnect, client->socket, probe_clock());
+    flightrec_record(FR_DISCONNECT, client->socket, 0, 0, relay->now);
+    client->closing = 1;
+    /* Clients still in their TLS handshake and dialed links were never announced */
+    if (relay->handler.on_close != NULL && !client->handshaking && client->peer != PEER_DIALED)
+        relay->handler.on_close(relay, client, relay->handler.arg);
+
+    /* A failed link is redialed later, frames move to a standby link if any */
+    if ((link = find_link(relay, client)) != NULL)
+        peer_retry(link, relay->now);
+    if (client->peer_id != 0 && !client->peer_standby)
+    {
+        syslog(LOG_INFO, "link to node %llu down\n", (unsigned long long)client->peer_id);
+        for (other = relay->clients; other != NULL; other = other->next)
+        {
+            if (other->peer_id == client->peer_id && other->peer_standby && !other->closing)
+            {
+                other->peer_standby = 0;
+                break;
+            }
+        }
+    }
+
+    journal_cursor_close(&client->replay);
+    outq_clear(&client->outq);
+    conflate_clear(&client->conflate);
+    zc_clear(&client->zc);
+    splice_pipe_close(&client->in_pipe);
+    splice_pipe_close(&client->out_pipe);
+    tls_session_free(client->tls, !client->handshaking);
+    if (client->shm != NULL)
+    {
+        shm_close(client->shm);
+        free(client->shm);
+    }
+    close(client->socket);
+
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        relay->clients = client->next;
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+    relay->client_count--;
+    route_remove(&relay->routes, client->id);
+    pool_release(relay->pool, client, sizeof(struct ClientConnection));
+}
+
+/* Set up a connection on sockfd and add it to the relay's list */
+static struct ClientConnection *add_client(struct Relay *relay, int sockfd, const struct sockaddr_in *addr, socklen_t addr_len)
+{
+    struct ClientConnection *client;
+
+    /* Create client connection */
+    client = (struct ClientConnection *)pool_alloc(relay->pool, sizeof(struct ClientConnection));
+    if (client == NULL)
+    {
+        syslog(LOG_ERR, "client allocation failed\n");
+        close(sockfd);
+        return NULL;
+    }
+    memset(client, 0, sizeof(struct ClientConnection));
+    client->id = route_add(&relay->routes, client);
+    if (client->id == 0)
+    {
+        syslog(LOG_ERR, "client id allocation failed\n");
+        pool_release(relay->pool, client, sizeof(struct ClientConnection));
+        close(sockfd);
+        return NULL;
+    }
+    client->socket = sockfd;
+    client->poll_slot = -1;
+    client->shm_slot = -1;
+    if (addr != NULL)
+        client->addr = *addr;
+    client->addr_len = addr_len;
+    client->replay.fd = -1;
+    splice_pipe_init(&client->in_pipe);
+    splice_pipe_init(&client->out_pipe);
+    /*
+     * kTLS has no MSG_ZEROCOPY, its own zero copy covers sendfile and splice;
+     * unix sockets, which have no address here, have none at all, and other
+     * framings send headers the kernel must not be left pointing at
+     */
+    client->outq.wire = relay->config.wire;
+    if (relay->config.zerocopyMin > 0 && relay->tls == NULL && addr != NULL && relay->config.wire == WIRE_LEGACY && zc_enable(&client->zc, sockfd, relay->config.zerocopyMin) != 0)
+        syslog(LOG_INFO, "zerocopy unavailable: %s (%d)\n", strerror(errno), errno);
+    bucket_init(&client->frame_bucket, relay->config.rateFrames, relay->now);
+    bucket_init(&client->byte_bucket, relay->config.rateBytes, relay->now);
+
+    /* Add client connection to list */
+    client->next = relay->clients;
+    if (relay->clients != NULL)
+        relay->clients->prev = client;
+    relay->clients = client;
+    relay->client_count++;
+    return client;
+}
+
+static void accept_client(struct Relay *relay)
+{
+    struct ClientConnection *client;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sockfd;
+
+    sockfd = accept4(relay->server_socket, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sockfd == -1)
+    {
+        syslog(LOG_ERR, "accept failed: %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+    client = add_client(relay, sockfd, &addr, addr_len);
+    if (client == NULL)
+        return;
+    PROBE2(accept, sockfd, probe_clock());
+    flightrec_record(FR_ACCEPT, sockfd, 0, 0, relay->now);
+
+    /* New subscribers start with a snapshot of every cached key */
+    if (relay->lvc != NULL && conflate_snapshot(&client->conflate, relay->lvc) != 0)
+        client->closing = 1;
+
+    /* TLS clients join once their handshake is done */
+    if (relay->tls != NULL)
+    {
+        client->tls = tls_session_new(relay->tls, sockfd);
+        if (client->tls == NULL)
+            client->closing = 1;
+        client->handshaking = TLS_WANT_READ;
+    }
+
+    if (relay->handler.on_accept != NULL && !client->handshaking)
+        relay->handler.on_accept(relay, client, relay->handler.arg);
+}
+
+/* Accept a client on the unix socket, which first negotiates its rings */
+static void accept_shm_client(struct Relay *relay)
+{
+    struct ClientConnection *client;
+    int sockfd;
+
+    sockfd = accept4(relay->unix_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sockfd == -1)
+    {
+        syslog(LOG_ERR, "accept failed: %s (%d)\n", strerror(errno), errno);
+        return;
+    }
+    client = add_client(relay, sockfd, NULL, 0);
+    if (client == NULL)
+        return;
+    PROBE2(accept, sockfd, probe_clock());
+    flightrec_record(FR_ACCEPT, sockfd, 0, 0, relay->now);
+
+    client->shm = (struct ShmChannel *)malloc(sizeof(struct ShmChannel));
+    if (client->shm == NULL)
+    {
+        syslog(LOG_ERR, "client allocation failed\n");
+        client->closing = 1;
+        return;
+    }
+    shm_init(client->shm);
+    client->handshaking = TLS_WANT_READ;
+}
+
+/*
+ * Read a unix client's CTRL_SHM_OPEN and pass it its rings. Returns 0 once
+ * done, TLS_WANT_READ while the request is incomplete, -1 on failure.
+ */
+static int shm_handshake(struct ClientConnection *client)
+{
+    struct FrameView view;
+    uint64_t size = 0;
+    int result;
+    int i;
+
+    result = recv(client->socket, client->buffer + client->pos, sizeof(client->buffer) - client->pos, MSG_DONTWAIT);
+    if (result == 0 || (result < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+        return -1;
+    if (result > 0)
+        client->pos += result;
+
+    /* shm.c speaks the legacy framing whatever the relay's, as does the reply */
+    result = wire_parse(WIRE_LEGACY, client->buffer, client->pos, sizeof(client->buffer), &view);
+    if (result == 0)
+        return TLS_WANT_READ;
+    if (result < 0 || !(view.flags & FRAME_CONTROL) || view.len < 9 || view.msg[0] != CTRL_SHM_OPEN)
+    {
+        syslog(LOG_ERR, "unix client did not ask for shared memory\n");
+        return -1;
+    }
+    for (i = 1; i < 9; i++)
+        size = (size << 8) | (view.msg[i] & 0xff);
+    client->pos = frame_compact(client->buffer, client->pos, result);
+    return shm_offer(client->shm, client->socket, size);
+}
+
+/* Dial every configured peer whose link is down and due for another try */
+static void dial_peers(struct Relay *relay)
+{
+    struct ClientConnection *client;
+    struct PeerLink *link;
+    int sockfd;
+    int i;
+
+    for (i = 0; i < relay->config.peerCount; i++)
+    {
+        link = &relay->peers[i];
+        if (link->client != NULL || relay->now < link->retry_at)
+            continue;
+        sockfd = peer_dial(link);
+        if (sockfd >= 0 && relay->config.busyPollSocket > 0)
+            setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &relay->config.busyPollSocket, sizeof(int));
+        client = sockfd >= 0 ? add_client(relay, sockfd, &link->addr, sizeof(link->addr)) : NULL;
+        if (client == NULL)
+        {
+            peer_retry(link, relay->now);
+            continue;
+        }
+        client->peer = PEER_DIALED;
+        client->connecting = 1;
+        link->client = client;
+    }
+}
+
+/* Poll fd for events this pass, returns its slot in the poll set */
+static int watch(struct Relay *relay, int fd, short events)
+{
+    struct pollfd *entry = &relay->polls[relay->poll_count];
+
+    entry->fd = fd;
+    entry->events = events;
+    entry->revents = 0;
+    return relay->poll_count++;
+}
+
+/* Whether the descriptor in slot polled ready for events, an error or a hangup counting as ready */
+static int polled(const struct Relay *relay, int slot, short events)
+{
+    if (slot < 0 || !(relay->polls[slot].events & events))
+        return 0;
+    return (relay->polls[slot].revents & (events | POLLERR | POLLHUP)) != 0;
+}
+
+/* Finish dialing a peer and say hello, returns -1 if the link failed */
+static int connect_peer(struct Relay *relay, struct ClientConnection *client)
+{
+    struct Frame *hello;
+
+    if (!polled(relay, client->poll_slot, POLLOUT))
+        return 0;
+    if (peer_connected(client->socket) != 0)
+        return -1;
+    client->connecting = 0;
+    hello = peer_hello(relay->config.nodeId);
+    if (hello == NULL)
+        return -1;
+    deliver(relay, client, hello, -1);
+    frame_unref(hello);
+    return 0;
+}
+
+/* Step a client's TLS or shm handshake, returns -1 if the client is to be dropped */
+static int handshake_client(struct Relay *relay, struct ClientConnection *client)
+{
+    if (!polled(relay, client->poll_slot, client->handshaking == TLS_WANT_WRITE ? POLLOUT : POLLIN))
+        return 0;
+    client->handshaking = client->shm != NULL ? shm_handshake(client) : tls_handshake(client->tls);
+    if (client->handshaking < 0)
+        return -1;
+    if (client->handshaking == 0 && relay->handler.on_accept != NULL)
+        relay->handler.on_accept(relay, client, relay->handler.arg);
+    return 0;
+}
+
+/* Relay the complete frames in a client's buffer, at most READ_BUDGET */
+static int read_frames(struct Relay *relay, struct ClientConnection *client)
+{
+    struct FrameView view;
+    size_t consumed = 0;
+    int budget;
+    int result;
+
+    client->backlog = 0;
+    for (budget = READ_BUDGET; !client->closing; budget--)
+    {
+        result = wire_parse(relay->config.wire, client->buffer + consumed, client->pos - consumed, sizeof(client->buffer), &view);
+        if (result < 0)
+        {
+            syslog(LOG_ERR, "message too long or misframed\n");
+            return -1;
+        }
+        if (result == 0)
+        {
+            /* A large frame still arriving may bypass the buffer */
+            result = splice_start(relay, client, client->buffer + consumed, client->pos - consumed);
+            if (result < 0)
+                return -1;
+            if (result > 0)
+                consumed = client->pos;
+            break;
+        }
+        if (budget == 0 || !may_read(client, relay->now))
+        {
+            client->backlog = 1;
+            break;
+        }
+        consumed += result;
+
+        /* A frame taken back from its pipe was counted when its splice started */
+        if (client->splice_refused)
+            client->splice_refused = 0;
+        else
+        {
+            PROBE4(frame, client->socket, view.len, view.flags, probe_clock());
+            flightrec_record(FR_FRAME, client->socket, view.len, view.flags, relay->now);
+            bucket_charge(&client->frame_bucket, 1);
+            bucket_charge(&client->byte_bucket, result);
+        }
+
+        /* Only what clients send is captured, a replay recreates the mesh traffic */
+        if (relay->capture != NULL && client->peer == PEER_NONE && capture_frame(relay->capture, client->id, relay->now, &view) != 0)
+            stop_capture(relay);
+
+        /* Control frames are for the daemon, not the other clients */
+        lag_mark(relay, LAG_FANOUT);
+        if (view.flags & FRAME_CONTROL)
+            handle_control(relay, client, &view);
+        /* Peer links carry nothing else, anything else on one is ignored */
+        else if (client->peer == PEER_NONE &&
+                 (relay->handler.on_frame == NULL || relay->handler.on_frame(relay, client, &view, relay->handler.arg)))
+            relay_data(relay, client, &view);
+        lag_mark(relay, LAG_PARSE);
+    }
+
+    /* Remove relayed messages from client buffer */
+    client->pos = frame_compact(client->buffer, client->pos, consumed);
+    return 0;
+}
+
+/*
+ * Read, relay, replay and flush for one client as its socket allows.
+ * Returns -1 if the client is to be dropped.
+ */
+static int serve_client(struct Relay *relay, struct ClientConnection *client)
+{
+    const struct OutqWindow *window = &relay->config.window;
+    int paused = relay->shedding || client_over_budget(relay, client);
+    int blocked;
+    int result;
+
+    /* Read what the client sent, paused clients are not polled for it */
+    lag_mark(relay, LAG_READ);
+    if (client->shm != NULL)
+    {
+        /* Frames come through the ring, the socket only ever tells of a hangup */
+        if (polled(relay, client->poll_slot, POLLIN))
+            return -1;
+        shm_wake(client->shm, polled(relay, client->shm_slot, POLLIN));
+        if (!paused && may_read(client, relay->now))
+            client->pos += shm_get(&client->shm->in, client->buffer + client->pos, sizeof(client->buffer) - client->pos);
+    }
+    else if (polled(relay, client->poll_slot, POLLIN) && client->splice_left > 0)
+    {
+        result = splice_in(&client->in_pipe, client->socket, client->splice_left);
+        if (result > 0)
+        {
+            client->splice_left -= result;
+            if (client->splice_left == 0)
+                splice_fan_out(relay, client);
+        }
+        /* The socket has data, so the pipe is full; polling on would spin */
+        else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (splice_refuse(client) != 0)
+                return -1;
+        }
+        else if (result == 0 || errno != EINTR)
+            return -1;
+    }
+    else if (polled(relay, client->poll_slot, POLLIN))
+    {
+        result = recv(client->socket, client->buffer + client->pos, sizeof(client->buffer) - client->pos, MSG_DONTWAIT);
+        if (result > 0)
+            client->pos += result;
+        else if (result == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+            return -1;
+    }
+
+    /* Release frames the kernel has finished sending zero-copy */
+    if (client->zc.count > 0 && zc_reap(&client->zc, client->socket) != 0)
+        return -1;
+
+    /* Relay complete messages, those already buffered wait while paused */
+    lag_mark(relay, LAG_PARSE);
+    if (!paused && read_frames(relay, client) != 0)
+        return -1;
+    lag_mark(relay, LAG_FLUSH);
+
+    /* Stream journaled frames to a replaying client */
+    if (client->replaying && polled(relay, client->poll_slot, POLLOUT))
+    {
+        result = journal_replay(relay->journal, &client->replay, client->socket);
+        if (result < 0)
+            return -1;
+        if (result > 0)
+            client->replaying = 0;
+    }
+
+    /* Drain queued frames once the socket has room or the window closes */
+    if (pending(client) && !client->replaying)
+    {
+        if (client->outq.blocked || client->out_pipe.bytes > 0 ? client->shm != NULL || polled(relay, client->poll_slot, POLLOUT)
+                                                               : relay->now - client->outq.since >= window->ns || client->outq.bytes >= window->bytes ||
+                                                                     client->outq.lanes[OUTQ_HIGH].count > 0)
+        {
+            blocked = client->outq.blocked;
+            result = flush_client(relay, client);
+            if (result < 0)
+                return -1;
+            if (result > 0 && blocked && relay->handler.on_drain != NULL)
+                relay->handler.on_drain(relay, client, relay->handler.arg);
+        }
+    }
+
+    /* A replay starts between frames, once nothing else is queued for the client */
+    if (client->replay_op != 0 && !client->replaying && !pending(client))
+    {
+        journal_cursor_close(&client->replay);
+        if (client->replay_op == CTRL_REPLAY_SEQ)
+            result = journal_seek_seq(relay->journal, client->replay_from, &client->replay);
+        else
+            result = journal_seek_time(relay->journal, client->replay_from, &client->replay);
+        client->replaying = result == 0;
+        client->replay_op = 0;
+    }
+    return 0;
+}
+
+/*
+ * Spin on the poll set with zero-timeout polls for up to the busyPoll
+ * budget, capped at wait, so a frame arriving meanwhile is picked up without
+ * a sleep and a wakeup. Returns like poll, 0 if nothing turned up and the
+ * caller should go on to block.
+ */
+static int busy_poll(struct Relay *relay, uint64_t wait)
+{
+    uint64_t deadline;
+    int result;
+
+    if ((uint64_t)relay->config.busyPoll * 1000 < wait)
+        wait = (uint64_t)relay->config.busyPoll * 1000;
+    deadline = relay->now + wait;
+    do
+    {
+        result = poll(relay->polls, relay->poll_count, 0);
+        if (result != 0)
+            return result;
+    } while (!relay->stop && now_ns() < deadline);
+    return 0;
+}
+
+/*
+ * One pass of the event loop: wait up to timeout_ms for activity, then
+ * accept, read, relay and flush. Returns -1 only if polling fails.
+ */
+int relay_run_once(struct Relay *relay, int timeout_ms)
+{
+    const struct OutqWindow *window = &relay->config.window;
+    struct ClientConnection *client;
+    struct ClientConnection *next;
+    struct pollfd *polls;
+    struct timespec timeout;
+    uint64_t next_due;
+    uint64_t wait;
+    uint64_t one;
+    short events;
+    int listen_slot;
+    int unix_slot;
+    int udp_slot;
+    int inbox_slot;
+    int result;
+    int paused;
+    int error;
+    int n;
+    int i;
+
+    /* The pool is mapped here, on the thread driving the relay and so on its node */
+    if (relay->config.poolSize > 0 && relay->pool == NULL)
+    {
+        relay->pool = pool_new(relay->config.poolSize, relay->config.poolFlags);
+        if (relay->pool == NULL)
+        {
+            syslog(LOG_ERR, "pool unavailable, allocating from the heap\n");
+            relay->config.poolSize = 0;
+        }
+    }
+
+    relay->now = now_ns();
+    if (relay->lag != NULL)
+        lag_begin(relay->lag, relay->now);
+    account_memory(relay);
+    dial_peers(relay);
+
+    /* Room for the listeners, the inbox and up to two descriptors a client */
+    if (relay->polls_size < (size_t)relay->client_count * 2 + 4)
+    {
+        polls = realloc(relay->polls, (relay->client_count * 2 + 4) * sizeof(struct pollfd));
+        if (polls == NULL)
+        {
+            syslog(LOG_ERR, "poll set allocation failed\n");
+            if (relay->lag != NULL)
+                lag_end(relay->lag, now_ns());
+            return -1;
+        }
+        relay->polls = polls;
+        relay->polls_size = relay->client_count * 2 + 4;
+    }
+
+    /* Rebuild the poll set, no new clients are taken while shedding load */
+    relay->poll_count = 0;
+    listen_slot = -1;
+    unix_slot = -1;
+    udp_slot = -1;
+    inbox_slot = -1;
+    if (relay->client_count < relay->config.maxClients && !relay->shedding)
+    {
+        listen_slot = watch(relay, relay->server_socket, POLLIN);
+        if (relay->unix_socket >= 0)
+            unix_slot = watch(relay, relay->unix_socket, POLLIN);
+    }
+    if (relay->udp != NULL)
+        udp_slot = watch(relay, relay->udp->sock, POLLIN);
+    if (relay->inbox != NULL)
+        inbox_slot = watch(relay, relay->inbox_efd, POLLIN);
+
+    /* Add clients to the poll set */
+    next_due = relay->now + (uint64_t)timeout_ms * 1000000;
+    for (i = 0; i < relay->config.peerCount; i++)
+    {
+        if (relay->peers[i].client == NULL && relay->peers[i].retry_at < next_due)
+            next_due = relay->peers[i].retry_at;
+    }
+    for (client = relay->clients; client != NULL; client = client->next)
+    {
+        client->poll_slot = -1;
+        client->shm_slot = -1;
+        if (client->connecting)
+        {
+            client->poll_slot = watch(relay, client->socket, POLLOUT);
+            continue;
+        }
+        if (client->handshaking)
+        {
+            client->poll_slot = watch(relay, client->socket, client->handshaking == TLS_WANT_WRITE ? POLLOUT : POLLIN);
+            continue;
+        }
+
+        /*
+         * Clients over their rate limit are left unread until they refill.
+         * All clients are while the relay sheds load, and one over its own
+         * memory budget is until its queue drains.
+         */
+        paused = relay->shedding || client_over_budget(relay, client);
+        events = 0;
+        if (may_read(client, relay->now))
+        {
+            /* A shm client is asked to kick its eventfd if the ring is empty */
+            if (client->pos < (int)sizeof(client->buffer) && !paused)
+            {
+                if (client->shm == NULL)
+                    events |= POLLIN;
+                else if (shm_consumer_sleep(&client->shm->in))
+                    next_due = relay->now;
+            }
+            if (client->backlog && !paused)
+                next_due = relay->now;
+        }
+        else
+        {
+            wait = bucket_wait(&client->frame_bucket, relay->now);
+            if (bucket_wait(&client->byte_bucket, relay->now) > wait)
+                wait = bucket_wait(&client->byte_bucket, relay->now);
+            if (relay->now + wait < next_due)
+                next_due = relay->now + wait;
+        }
+
+        if (client->shm != NULL)
+        {
+            events |= POLLIN;
+            client->shm_slot = watch(relay, client->shm->efd, POLLIN);
+        }
+        if (client->shm != NULL && client->outq.blocked)
+        {
+            if (shm_producer_sleep(&client->shm->out))
+                next_due = relay->now;
+        }
+        else if (client->replaying || client->outq.blocked || client->out_pipe.bytes > 0)
+            events |= POLLOUT;
+        else if (pending(client) &&
+                 client->outq.since + window->ns < next_due)
+            next_due = client->outq.since + window->ns;
+        if (events != 0)
+            client->poll_slot = watch(relay, client->socket, events);
+    }
+
+    /* Wake up in time for the earliest coalescing window or rate refill */
+    wait = next_due > relay->now ? next_due - relay->now : 0;
+
+    /* Captured frames reach the file whenever the loop is about to idle */
+    if (relay->capture != NULL && relay->capture->pos > 0 && wait > 0 && capture_flush(relay->capture) != 0)
+        stop_capture(relay);
+
+    /* Posters kick the eventfd from here on, unless a frame already came */
+    if (relay->inbox != NULL)
+    {
+        __atomic_store_n(&relay->inbox_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!fq_empty(relay->inbox))
+            wait = 0;
+    }
+
+    /* Wait for activity, spinning first if asked to and sleeping on a miss */
+    lag_mark(relay, LAG_POLL);
+    result = 0;
+    if (relay->config.busyPoll > 0 && wait > 0)
+    {
+        result = busy_poll(relay, wait);
+        if (result == 0)
+        {
+            relay->now = now_ns();
+            wait = next_due > relay->now ? next_due - relay->now : 0;
+        }
+    }
+    if (result == 0)
+    {
+        timeout.tv_sec = wait / 1000000000ull;
+        timeout.tv_nsec = wait % 1000000000ull;
+        result = ppoll(relay->polls, relay->poll_count, &timeout, NULL);
+    }
+    if (result == -1)
+    {
+        error = errno;
+        if (relay->lag != NULL)
+            lag_end(relay->lag, now_ns());
+        if (error == EINTR)
+            return 0;
+        syslog(LOG_ERR, "poll failed: %s (%d)\n", strerror(error), error);
+        flightrec_record(FR_ERROR, -1, error, __LINE__, relay->now);
+        return -1;
+    }
+    relay->now = now_ns();
+    lag_mark(relay, LAG_OTHER);
+
+    /* Frames posted from other threads */
+    if (relay->inbox != NULL)
+    {
+        __atomic_store_n(&relay->inbox_sleeping, 0, __ATOMIC_RELAXED);
+        if (polled(relay, inbox_slot, POLLIN) && read(relay->inbox_efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+            syslog(LOG_ERR, "eventfd read failed: %s (%d)\n", strerror(errno), errno);
+        lag_mark(relay, LAG_FANOUT);
+        take_posted(relay);
+        lag_mark(relay, LAG_OTHER);
+    }
+
+    /* Relay datagrams, a bounded number of batches per wakeup */
+    if (polled(relay, udp_slot, POLLIN))
+    {
+        for (i = 0; i < UDP_BUDGET; i++)
+        {
+            if (udp_relay_batch(relay->udp) < UDP_BATCH)
+                break;
+        }
+    }
+
+    /* Add new clients, the socket is not polled while at maxClients */
+    lag_mark(relay, LAG_ACCEPT);
+    if (polled(relay, listen_slot, POLLIN))
+        accept_client(relay);
+    if (polled(relay, unix_slot, POLLIN))
+        accept_shm_client(relay);
+
+    /*
+     * Check clients. Each pass starts one client further along the list and
+     * relays at most READ_BUDGET frames per client, so one busy producer
+     * cannot starve the others.
+     */
+    client = relay->rr_start != NULL ? relay->rr_start : relay->clients;
+    if (client != NULL)
+        relay->rr_start = client->next != NULL ? client->next : relay->clients;
+    for (n = relay->client_count; n > 0 && client != NULL; n--)
+    {
+        next = client->next != NULL ? client->next : relay->clients;
+
+        /* A TLS client or a dialed link takes part in nothing until it is up */
+        if (client->connecting || client->handshaking)
+            lag_mark(relay, LAG_ACCEPT);
+        if (client->connecting)
+            error = connect_peer(relay, client) != 0;
+        else if (client->handshaking)
+            error = handshake_client(relay, client) != 0;
+        else
+            error = serve_client(relay, client) != 0;
+        if (client->closing)
+            error = 1;
+
+        /* Remove client connection from list */
+        if (error)
+        {
+            syslog(LOG_INFO, "client disconnected\n");
+            lag_mark(relay, LAG_OTHER);
+            if (relay->rr_start == client)
+                relay->rr_start = next != client ? next : NULL;
+            drop_client(relay, client);
+        }
+
+        client = next;
+    }
+    if (relay->lag != NULL)
+        lag_end(relay->lag, now_ns());
+    return 0;
+}
+
+/* Run the event loop until relay_stop() is called or polling fails */
+int relay_run(struct Relay *relay)
+{
+    relay->stop = 0;
+    while (!relay->stop)
+    {
+        if (relay_run_once(relay, 1000) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Safe to call from a signal handler or a relay callback */
+void relay_stop(struct Relay *relay)
+{
+    relay->stop = 1;
+}
+
+void relay_free(struct Relay *relay)
+{
+    struct Frame *frame;
+
+    if (relay == NULL)
+        return;
+    while (relay->clients != NULL)
+        drop_client(relay, relay->clients);
+    if (relay->server_socket >= 0)
+        close(relay->server_socket);
+    if (relay->unix_socket >= 0)
+    {
+        close(relay->unix_socket);
+        unlink(relay->config.unixPath);
+    }
+    splice_pipe_close(&relay->scratch);
+    if (relay->tls != NULL)
+        tls_server_free(relay->tls);
+    if (relay->udp != NULL)
+    {
+        udp_close(relay->udp);
+        free(relay->udp);
+    }
+    if (relay->journal != NULL)
+    {
+        journal_close(relay->journal);
+        free(relay->journal);
+    }
+    if (relay->capture != NULL)
+    {
+        capture_close(relay->capture);
+        free(relay->capture);
+    }
+    if (relay->lvc != NULL)
+    {
+        lvc_free(relay->lvc);
+        free(relay->lvc);
+    }
+    if (relay->lag != NULL)
+    {
+        admin_remove_metrics(lag_metrics, relay->lag);
+        lag_stop(relay->lag);
+        free(relay->lag);
+    }
+    if (relay->senders != NULL)
+    {
+        fanout_stop(relay->senders);
+        free(relay->senders);
+    }
+    free(relay->sends);
+    free(relay->polls);
+    if (relay->inbox != NULL)
+    {
+        while (fq_pop(relay->inbox, &frame, 1) == 1)
+            frame_unref(frame);
+        fq_free(relay->inbox);
+        free(relay->inbox);
+    }
+    if (relay->inbox_efd >= 0)
+        close(relay->inbox_efd);
+    route_free(&relay->routes);
+    frame_memory_release(relay->frames);
+    pool_free(relay->pool);
+    free(relay);
+}
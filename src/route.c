@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "route.h"
+#include "daemonize.h"
+
+static uint32_t id_hash(uint64_t id)
+{
+    id *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(id >> 32);
+}
+
+static void insert(struct RouteTable *table, uint64_t id, struct ClientConnection *client)
+{
+    uint32_t i;
+
+    i = id_hash(id) & table->mask;
+    while (table->slots[i].id != 0)
+        i = (i + 1) & table->mask;
+    table->slots[i].id = id;
+    table->slots[i].client = client;
+    table->count++;
+}
+
+static int grow(struct RouteTable *table)
+{
+    struct RouteSlot *old = table->slots;
+    uint32_t size = table->mask + 1;
+    uint32_t i;
+
+    table->slots = calloc(size * 2, sizeof(struct RouteSlot));
+    if (table->slots == NULL)
+    {
+        table->slots = old;
+        return -1;
+    }
+    table->mask = size * 2 - 1;
+    table->count = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (old[i].id != 0)
+            insert(table, old[i].id, old[i].client);
+    }
+    free(old);
+    return 0;
+}
+
+int route_init(struct RouteTable *table)
+{
+    table->slots = calloc(ROUTE_CAPACITY, sizeof(struct RouteSlot));
+    if (table->slots == NULL)
+        return -1;
+    table->mask = ROUTE_CAPACITY - 1;
+    table->count = 0;
+    table->next_id = 1;
+    return 0;
+}
+
+/* Give client the next id, returns 0 if the index could not grow */
+uint64_t route_add(struct RouteTable *table, struct ClientConnection *client)
+{
+    uint64_t id;
+
+    if (table->count + 1 > (table->mask + 1) / 2 && grow(table) != 0)
+        return 0;
+    id = table->next_id++;
+    insert(table, id, client);
+    return id;
+}
+
+struct ClientConnection *route_find(struct RouteTable *table, uint64_t id)
+{
+    uint32_t i;
+
+    if (id == 0)
+        return NULL;
+    for (i = id_hash(id) & table->mask; table->slots[i].id != 0; i = (i + 1) & table->mask)
+    {
+        if (table->slots[i].id == id)
+            return table->slots[i].client;
+    }
+    return NULL;
+}
+
+/* Remove id, moving back later entries of its probe chain into the hole */
+void route_remove(struct RouteTable *table, uint64_t id)
+{
+    uint32_t hole;
+    uint32_t home;
+    uint32_t i;
+
+    if (id == 0)
+        return;
+    for (hole = id_hash(id) & table->mask; table->slots[hole].id != id; hole = (hole + 1) & table->mask)
+    {
+        if (table->slots[hole].id == 0)
+            return;
+    }
+    for (i = (hole + 1) & table->mask; table->slots[i].id != 0; i = (i + 1) & table->mask)
+    {
+        /* An entry may fill the hole unless its home lies cyclically in (hole, i] */
+        home = id_hash(table->slots[i].id) & table->mask;
+        if (((i - home) & table->mask) >= ((i - hole) & table->mask))
+        {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+    }
+    table->slots[hole].id = 0;
+    table->slots[hole].client = NULL;
+    table->count--;
+}
+
+void route_free(struct RouteTable *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+}
+
+static void put_u64(char *msg, uint64_t value)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--)
+    {
+        msg[i] = value;
+        value >>= 8;
+    }
+}
+
+/* A CTRL_ROUTE frame as the target gets it, addressed from source */
+struct Frame *route_forward(struct Pool *pool, const struct FrameView *view, uint64_t source)
+{
+    struct Frame *frame;
+
+    frame = frame_alloc_in(pool, view->len, FRAME_CONTROL | (view->flags & FRAME_PRIORITY));
+    if (frame == NULL)
+        return NULL;
+    memcpy(frame->data + 4, view->msg, view->len);
+    put_u64(frame->data + 5, source);
+    return frame;
+}
+
+/* Bounce the header of a CTRL_ROUTE frame whose target is gone */
+struct Frame *route_unreachable(struct Pool *pool, const struct FrameView *view)
+{
+    struct Frame *frame;
+
+    frame = frame_alloc_in(pool, 17, FRAME_CONTROL | FRAME_PRIORITY);
+    if (frame == NULL)
+        return NULL;
+    memcpy(frame->data + 4, view->msg, 17);
+    frame->data[4] = CTRL_UNREACHABLE;
+    return frame;
+}
+
+struct Frame *route_client_id(struct Pool *pool, uint64_t id)
+{
+    struct Frame *frame;
+
+    frame = frame_alloc_in(pool, 9, FRAME_CONTROL | FRAME_PRIORITY);
+    if (frame == NULL)
+        return NULL;
+    frame->data[4] = CTRL_CLIENT_ID;
+    put_u64(frame->data + 5, id);
+    return frame;
+}
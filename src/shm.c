@@ -0,0 +1,310 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "shm.h"
+#include "daemonize.h"
+
+/* Descriptors passed with the reply: mapping, client's eventfd, daemon's */
+#define SHM_FDS 3
+
+void shm_init(struct ShmChannel *channel)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->efd = -1;
+    channel->peer_efd = -1;
+}
+
+/* Point the rings into the mapping, in is the direction towards this side */
+static void shm_map(struct ShmChannel *channel, size_t size, int client)
+{
+    struct ShmRingHeader *to_daemon = (struct ShmRingHeader *)channel->base;
+    struct ShmRingHeader *to_client = (struct ShmRingHeader *)((char *)channel->base + 128);
+    char *data = (char *)channel->base + SHM_HEADER_SIZE;
+    struct ShmRing *in = client ? &channel->out : &channel->in;
+    struct ShmRing *out = client ? &channel->in : &channel->out;
+
+    in->header = to_daemon;
+    in->data = data;
+    out->header = to_client;
+    out->data = data + size;
+    in->size = out->size = size;
+    in->kick = out->kick = channel->peer_efd;
+}
+
+/* A control frame with an opcode and an 8-byte big-endian value */
+static void shm_message(char *msg, uint64_t value)
+{
+    int i;
+
+    msg[0] = (char)((FRAME_CONTROL | 9) >> 24);
+    msg[1] = 0;
+    msg[2] = 0;
+    msg[3] = 9;
+    msg[4] = CTRL_SHM_OPEN;
+    for (i = 12; i > 4; i--)
+    {
+        msg[i] = value;
+        value >>= 8;
+    }
+}
+
+static int valid_size(uint64_t size)
+{
+    return size >= SHM_RING_MIN && size <= SHM_RING_MAX && (size & (size - 1)) == 0;
+}
+
+/*
+ * Daemon side: create the mapping and eventfds for a client that asked for
+ * rings of size bytes (0 for the default) and pass them to it with the
+ * reply. Returns -1 on failure, the channel is then left for shm_close.
+ */
+int shm_offer(struct ShmChannel *channel, int sockfd, uint64_t size)
+{
+    char reply[13];
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    struct iovec iov = {reply, sizeof(reply)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fds[SHM_FDS];
+    int memfd;
+
+    if (size == 0)
+        size = SHM_RING_SIZE;
+    if (!valid_size(size))
+    {
+        syslog(LOG_ERR, "invalid shm ring size %llu\n", (unsigned long long)size);
+        return -1;
+    }
+
+    memfd = memfd_create("daemonize-shm", MFD_CLOEXEC);
+    if (memfd == -1)
+    {
+        syslog(LOG_ERR, "memfd_create failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    channel->map_size = SHM_HEADER_SIZE + 2 * size;
+    if (ftruncate(memfd, channel->map_size) == -1)
+    {
+        syslog(LOG_ERR, "ftruncate failed: %s (%d)\n", strerror(errno), errno);
+        close(memfd);
+        return -1;
+    }
+    channel->base = mmap(NULL, channel->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+    if (channel->base == MAP_FAILED)
+    {
+        syslog(LOG_ERR, "mmap failed: %s (%d)\n", strerror(errno), errno);
+        channel->base = NULL;
+        close(memfd);
+        return -1;
+    }
+    channel->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (channel->efd == -1 || channel->peer_efd == -1)
+    {
+        syslog(LOG_ERR, "eventfd failed: %s (%d)\n", strerror(errno), errno);
+        close(memfd);
+        return -1;
+    }
+    shm_map(channel, size, 0);
+
+    /* The client sleeps on peer_efd and kicks efd */
+    fds[0] = memfd;
+    fds[1] = channel->peer_efd;
+    fds[2] = channel->efd;
+    shm_message(reply, size);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(reply))
+    {
+        syslog(LOG_ERR, "shm offer failed: %s (%d)\n", strerror(errno), errno);
+        close(memfd);
+        return -1;
+    }
+    close(memfd);
+    return 0;
+}
+
+/*
+ * Client side: ask the daemon for rings of size bytes (0 for the default)
+ * as the first thing on a connection to its unix socket, and map what it
+ * passes back. Blocks until the daemon answers.
+ */
+int shm_open_client(struct ShmChannel *channel, int sockfd, uint64_t size)
+{
+    char request[13];
+    char reply[13];
+    char control[CMSG_SPACE(SHM_FDS * sizeof(int))];
+    struct iovec iov = {reply, sizeof(reply)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fds[SHM_FDS];
+    uint64_t granted = 0;
+    int i;
+
+    shm_message(request, size);
+    if (send(sockfd, request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+        return -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sockfd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(reply))
+        return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return -1;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    for (i = 5; i < 13; i++)
+        granted = (granted << 8) | (reply[i] & 0xff);
+    channel->efd = fds[1];
+    channel->peer_efd = fds[2];
+    if (reply[4] != CTRL_SHM_OPEN || !valid_size(granted))
+    {
+        close(fds[0]);
+        return -1;
+    }
+
+    channel->map_size = SHM_HEADER_SIZE + 2 * granted;
+    channel->base = mmap(NULL, channel->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fds[0], 0);
+    close(fds[0]);
+    if (channel->base == MAP_FAILED)
+    {
+        channel->base = NULL;
+        return -1;
+    }
+    shm_map(channel, granted, 1);
+    return 0;
+}
+
+void shm_close(struct ShmChannel *channel)
+{
+    if (channel->base != NULL)
+        munmap(channel->base, channel->map_size);
+    if (channel->efd >= 0)
+        close(channel->efd);
+    if (channel->peer_efd >= 0)
+        close(channel->peer_efd);
+    shm_init(channel);
+}
+
+static void kick(int efd)
+{
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "eventfd write failed: %s (%d)\n", strerror(errno), errno);
+}
+
+/*
+ * Copy as much of iov into the ring as fits, kicking the consumer if it is
+ * asleep. Returns the bytes written, 0 if the ring is full.
+ */
+size_t shm_putv(struct ShmRing *ring, const struct iovec *iov, int count)
+{
+    struct ShmRingHeader *header = ring->header;
+    uint64_t tail = header->tail;
+    size_t room = ring->size - (tail - __atomic_load_n(&header->head, __ATOMIC_ACQUIRE));
+    size_t done = 0;
+    size_t offset;
+    size_t first;
+    size_t n;
+    int i;
+
+    for (i = 0; i < count && room > 0; i++)
+    {
+        n = iov[i].iov_len < room ? iov[i].iov_len : room;
+        offset = (tail + done) & (ring->size - 1);
+        first = n < ring->size - offset ? n : ring->size - offset;
+        memcpy(ring->data + offset, iov[i].iov_base, first);
+        memcpy(ring->data, (char *)iov[i].iov_base + first, n - first);
+        done += n;
+        room -= n;
+    }
+    if (done == 0)
+        return 0;
+
+    __atomic_store_n(&header->tail, tail + done, __ATOMIC_RELEASE);
+    /* Either the consumer sees the new tail or we see it asleep */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->consumer_idle, __ATOMIC_RELAXED))
+        kick(ring->kick);
+    return done;
+}
+
+size_t shm_put(struct ShmRing *ring, const void *data, size_t len)
+{
+    struct iovec iov = {(void *)data, len};
+
+    return shm_putv(ring, &iov, 1);
+}
+
+/* Copy up to len bytes out of the ring, kicking a producer waiting for room */
+size_t shm_get(struct ShmRing *ring, void *buf, size_t len)
+{
+    struct ShmRingHeader *header = ring->header;
+    uint64_t head = header->head;
+    size_t avail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) - head;
+    size_t offset = head & (ring->size - 1);
+    size_t first;
+    size_t n;
+
+    n = len < avail ? len : avail;
+    if (n == 0)
+        return 0;
+    first = n < ring->size - offset ? n : ring->size - offset;
+    memcpy(buf, ring->data + offset, first);
+    memcpy((char *)buf + first, ring->data, n - first);
+
+    __atomic_store_n(&header->head, head + n, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->producer_waiting, __ATOMIC_RELAXED))
+        kick(ring->kick);
+    return n;
+}
+
+size_t shm_used(const struct ShmRing *ring)
+{
+    return __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+/* About to sleep until the ring has data: returns 1 if it already has */
+int shm_consumer_sleep(struct ShmRing *ring)
+{
+    __atomic_store_n(&ring->header->consumer_idle, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return shm_used(ring) > 0;
+}
+
+/* About to sleep until the ring has room: returns 1 if it already has */
+int shm_producer_sleep(struct ShmRing *ring)
+{
+    __atomic_store_n(&ring->header->producer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return shm_used(ring) < ring->size;
+}
+
+/* Awake again: lower this side's flags, and reset its eventfd if it fired */
+void shm_wake(struct ShmChannel *channel, int kicked)
+{
+    uint64_t count;
+
+    __atomic_store_n(&channel->in.header->consumer_idle, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&channel->out.header->producer_waiting, 0, __ATOMIC_RELAXED);
+    if (kicked && read(channel->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "eventfd read failed: %s (%d)\n", strerror(errno), errno);
+}
@@ -0,0 +1,160 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+
+#include "splice.h"
+
+void splice_pipe_init(struct SplicePipe *pipe)
+{
+    pipe->rd = -1;
+    pipe->wr = -1;
+    pipe->bytes = 0;
+}
+
+/* Open the pipe on first use, a no-op once it is open */
+int splice_pipe_open(struct SplicePipe *pipe)
+{
+    int fds[2];
+
+    if (pipe->rd >= 0)
+        return 0;
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        syslog(LOG_ERR, "pipe failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    /* Best effort, a socket splice takes one pipe slot per segment */
+    fcntl(fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    pipe->rd = fds[0];
+    pipe->wr = fds[1];
+    pipe->bytes = 0;
+    return 0;
+}
+
+void splice_pipe_close(struct SplicePipe *pipe)
+{
+    if (pipe->rd >= 0)
+    {
+        close(pipe->rd);
+        close(pipe->wr);
+    }
+    splice_pipe_init(pipe);
+}
+
+/* Move up to len bytes waiting on sockfd into the pipe, as splice() returns */
+ssize_t splice_in(struct SplicePipe *pipe, int sockfd, size_t len)
+{
+    ssize_t n;
+
+    n = splice(sockfd, NULL, pipe->wr, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0)
+        pipe->bytes += n;
+    return n;
+}
+
+/* Copy a few bytes, such as a length word, into an empty pipe */
+int splice_put(struct SplicePipe *pipe, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(pipe->wr, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        pipe->bytes += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Duplicate the first len bytes of from into to, leaving from untouched.
+ * to must have room for them, which an empty pipe of the same size has.
+ */
+int splice_tee(struct SplicePipe *from, struct SplicePipe *to, size_t len)
+{
+    ssize_t n;
+
+    /* tee always starts at the front of from, so a short one cannot be resumed */
+    do
+        n = tee(from->rd, to->wr, len, SPLICE_F_NONBLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n < 0 || (size_t)n < len)
+        return -1;
+    to->bytes += n;
+    return 0;
+}
+
+/* Move len bytes from one pipe to another */
+int splice_move(struct SplicePipe *from, struct SplicePipe *to, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = splice(from->rd, NULL, to->wr, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        from->bytes -= n;
+        to->bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Copy len bytes out of the pipe into userspace */
+int splice_read(struct SplicePipe *pipe, char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = read(pipe->rd, data, len);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        pipe->bytes -= n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Send what the pipe holds to sockfd. Returns 1 once the pipe is empty, 0
+ * if the socket filled up first, or -1 on a socket error.
+ */
+int splice_out(struct SplicePipe *pipe, int sockfd)
+{
+    ssize_t n;
+
+    while (pipe->bytes > 0)
+    {
+        n = splice(pipe->rd, NULL, sockfd, NULL, pipe->bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        pipe->bytes -= n;
+    }
+    return 1;
+}
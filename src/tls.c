@@ -0,0 +1,167 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+
+#include "tls.h"
+
+#ifdef DAEMONIZE_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TLS_TX_ZEROCOPY_RO
+#define TLS_TX_ZEROCOPY_RO 3
+#endif
+
+static void tls_log_error(const char *what)
+{
+    char reason[256];
+
+    ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+    syslog(LOG_ERR, "%s: %s\n", what, reason);
+    ERR_clear_error();
+}
+
+struct ssl_ctx_st *tls_server_new(const char *cert, const char *key)
+{
+    SSL_CTX *ctx;
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL)
+    {
+        tls_log_error("tls context failed");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION);
+    /* Ciphers the kernel can take over */
+    SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+    /* Post-handshake messages would arrive as records kTLS hands back as errors */
+    SSL_CTX_set_num_tickets(ctx, 0);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1)
+    {
+        tls_log_error("tls certificate failed");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* Start a server session on sockfd, which stays non-blocking like every client socket */
+struct ssl_st *tls_session_new(struct ssl_ctx_st *ctx, int sockfd)
+{
+    SSL *ssl;
+
+    ssl = SSL_new(ctx);
+    if (ssl == NULL)
+    {
+        tls_log_error("tls session failed");
+        return NULL;
+    }
+    if (SSL_set_fd(ssl, sockfd) != 1 || fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        tls_log_error("tls session failed");
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+/*
+ * Advance the handshake. Returns 0 once it is done and kTLS carries the
+ * session, TLS_WANT_READ or TLS_WANT_WRITE while it needs the socket, or
+ * -1 if it failed or kTLS could not be enabled.
+ */
+int tls_handshake(struct ssl_st *ssl)
+{
+    int sockfd = SSL_get_fd(ssl);
+    int one = 1;
+    int result;
+
+    result = SSL_do_handshake(ssl);
+    if (result != 1)
+    {
+        switch (SSL_get_error(ssl, result))
+        {
+        case SSL_ERROR_WANT_READ:
+            return TLS_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_WANT_WRITE;
+        default:
+            tls_log_error("tls handshake failed");
+            return -1;
+        }
+    }
+
+    if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+    {
+        syslog(LOG_ERR, "kernel tls unavailable for %s, client refused\n", SSL_get_cipher_name(ssl));
+        return -1;
+    }
+
+    /* sendfile and splice may encrypt straight from the page cache, best effort */
+    setsockopt(sockfd, SOL_TLS, TLS_TX_ZEROCOPY_RO, &one, sizeof(one));
+    return 0;
+}
+
+void tls_session_free(struct ssl_st *ssl, int established)
+{
+    if (ssl == NULL)
+        return;
+    /* Tell the peer the stream ends here rather than being cut */
+    if (established)
+        SSL_shutdown(ssl);
+    SSL_free(ssl);
+}
+
+void tls_server_free(struct ssl_ctx_st *ctx)
+{
+    SSL_CTX_free(ctx);
+}
+
+#else
+
+struct ssl_ctx_st *tls_server_new(const char *cert, const char *key)
+{
+    (void)cert;
+    (void)key;
+    syslog(LOG_ERR, "built without TLS support, rebuild with make TLS=1\n");
+    return NULL;
+}
+
+struct ssl_st *tls_session_new(struct ssl_ctx_st *ctx, int sockfd)
+{
+    (void)ctx;
+    (void)sockfd;
+    return NULL;
+}
+
+int tls_handshake(struct ssl_st *ssl)
+{
+    (void)ssl;
+    return -1;
+}
+
+void tls_session_free(struct ssl_st *ssl, int established)
+{
+    (void)ssl;
+    (void)established;
+}
+
+void tls_server_free(struct ssl_ctx_st *ctx)
+{
+    (void)ctx;
+}
+
+#endif
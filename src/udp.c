@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include "udp.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+/* Largest UDP payload a single GSO send may carry */
+#define UDP_GSO_MAX_BYTES 65000
+
+int udp_open(struct UdpRelay *udp, int port, const char *group)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    int one = 1;
+    int seg = UDP_MAX_DATAGRAM;
+    int i;
+
+    memset(udp, 0, sizeof(*udp));
+    udp->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (udp->sock < 0)
+    {
+        syslog(LOG_ERR, "udp socket failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    setsockopt(udp->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(udp->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        syslog(LOG_ERR, "udp bind failed: %s (%d)\n", strerror(errno), errno);
+        close(udp->sock);
+        return -1;
+    }
+
+    /* Join the feed's multicast group */
+    if (group != NULL)
+    {
+        memset(&mreq, 0, sizeof(mreq));
+        if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1)
+        {
+            syslog(LOG_ERR, "invalid multicast group %s\n", group);
+            close(udp->sock);
+            return -1;
+        }
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(udp->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            syslog(LOG_ERR, "multicast join failed: %s (%d)\n", strerror(errno), errno);
+            close(udp->sock);
+            return -1;
+        }
+    }
+
+    /* Probe for UDP GSO, older kernels fall back to one datagram per message */
+    udp->gso = setsockopt(udp->sock, IPPROTO_UDP, UDP_SEGMENT, &seg, sizeof(seg)) == 0;
+    if (udp->gso)
+    {
+        seg = 0;
+        setsockopt(udp->sock, IPPROTO_UDP, UDP_SEGMENT, &seg, sizeof(seg));
+    }
+
+    for (i = 0; i < UDP_BATCH; i++)
+    {
+        udp->rx_iov[i].iov_base = udp->rx_buf[i];
+        udp->rx_iov[i].iov_len = UDP_MAX_DATAGRAM;
+        udp->rx_msgs[i].msg_hdr.msg_iov = &udp->rx_iov[i];
+        udp->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+int udp_add_subscriber(struct UdpRelay *udp, const char *endpoint)
+{
+    struct sockaddr_in *addr;
+    char host[INET_ADDRSTRLEN];
+    const char *colon;
+    unsigned char ttl = 1;
+
+    if (udp->subscriber_count >= UDP_MAX_SUBSCRIBERS)
+    {
+        syslog(LOG_ERR, "too many udp subscribers\n");
+        return -1;
+    }
+    colon = strchr(endpoint, ':');
+    if (colon == NULL || colon - endpoint >= (int)sizeof(host))
+    {
+        syslog(LOG_ERR, "invalid udp subscriber %s\n", endpoint);
+        return -1;
+    }
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+
+    addr = &udp->subscribers[udp->subscriber_count];
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(colon + 1));
+    if (inet_pton(AF_INET, host, &addr->sin_addr) != 1)
+    {
+        syslog(LOG_ERR, "invalid udp subscriber %s\n", endpoint);
+        return -1;
+    }
+
+    /* Keep republished multicast on the local segment */
+    if (IN_MULTICAST(ntohl(addr->sin_addr.s_addr)))
+        setsockopt(udp->sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    udp->subscriber_count++;
+    return 0;
+}
+
+/*
+ * Group received datagrams into runs that can leave in one send. With GSO a
+ * run is consecutive equal-sized datagrams (the last may be shorter) packed
+ * into gso_buf; without it every datagram is its own run. Returns the number
+ * of runs, each described by tx_iov[run] and tx_cmsg[run].
+ */
+static int udp_build_runs(struct UdpRelay *udp, int count, size_t *cmsg_len)
+{
+    struct cmsghdr *cmsg;
+    size_t off = 0;
+    unsigned int seg;
+    int runs = 0;
+    int segments;
+    int i = 0;
+
+    while (i < count)
+    {
+        seg = udp->rx_msgs[i].msg_len;
+        if (!udp->gso)
+        {
+            udp->tx_iov[runs].iov_base = udp->rx_buf[i];
+            udp->tx_iov[runs].iov_len = seg;
+            cmsg_len[runs] = 0;
+            runs++;
+            i++;
+            continue;
+        }
+
+        udp->tx_iov[runs].iov_base = udp->gso_buf + off;
+        udp->tx_iov[runs].iov_len = 0;
+        segments = 0;
+        while (i < count && segments < UDP_MAX_GSO_SEGMENTS &&
+               udp->rx_msgs[i].msg_len <= seg &&
+               udp->tx_iov[runs].iov_len + udp->rx_msgs[i].msg_len <= UDP_GSO_MAX_BYTES)
+        {
+            memcpy(udp->gso_buf + off, udp->rx_buf[i], udp->rx_msgs[i].msg_len);
+            off += udp->rx_msgs[i].msg_len;
+            udp->tx_iov[runs].iov_len += udp->rx_msgs[i].msg_len;
+            segments++;
+            i++;
+            /* A short datagram can only be the tail of a run */
+            if (udp->rx_msgs[i - 1].msg_len < seg)
+                break;
+        }
+
+        cmsg_len[runs] = 0;
+        if (segments > 1)
+        {
+            cmsg = (struct cmsghdr *)udp->tx_cmsg[runs];
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+            *(unsigned short *)CMSG_DATA(cmsg) = seg;
+            cmsg_len[runs] = CMSG_SPACE(sizeof(unsigned short));
+        }
+        runs++;
+    }
+    return runs;
+}
+
+/*
+ * Drain one batch of datagrams with recvmmsg and fan it out to every
+ * subscriber with sendmmsg. Returns the number of datagrams relayed, 0 when
+ * the socket had nothing to read, or -1 on a fatal socket error.
+ */
+int udp_relay_batch(struct UdpRelay *udp)
+{
+    size_t cmsg_len[UDP_BATCH];
+    struct msghdr *hdr;
+    int count;
+    int runs;
+    int total;
+    int done;
+    int sent;
+    int r;
+    int s;
+    int i;
+
+    for (i = 0; i < UDP_BATCH; i++)
+        udp->rx_msgs[i].msg_hdr.msg_flags = 0;
+
+    count = recvmmsg(udp->sock, udp->rx_msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        syslog(LOG_ERR, "recvmmsg failed: %s (%d)\n", strerror(errno), errno);
+        return -1;
+    }
+    if (count == 0 || udp->subscriber_count == 0)
+        return count;
+
+    /* Truncated datagrams are not valid frames */
+    for (i = 0; i < count; i++)
+    {
+        if (udp->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            udp->rx_msgs[i].msg_len = 0;
+    }
+
+    runs = udp_build_runs(udp, count, cmsg_len);
+
+    total = 0;
+    for (s = 0; s < udp->subscriber_count; s++)
+    {
+        for (r = 0; r < runs; r++)
+        {
+            if (udp->tx_iov[r].iov_len == 0)
+                continue;
+            hdr = &udp->tx_msgs[total].msg_hdr;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->msg_name = &udp->subscribers[s];
+            hdr->msg_namelen = sizeof(udp->subscribers[s]);
+            hdr->msg_iov = &udp->tx_iov[r];
+            hdr->msg_iovlen = 1;
+            if (cmsg_len[r] != 0)
+            {
+                hdr->msg_control = udp->tx_cmsg[r];
+                hdr->msg_controllen = cmsg_len[r];
+            }
+            total++;
+        }
+    }
+
+    /* Datagrams are best effort, a full socket buffer drops the rest */
+    done = 0;
+    while (done < total)
+    {
+        sent = sendmmsg(udp->sock, udp->tx_msgs + done, total - done, MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            /* Skip the message the kernel refused, e.g. an unreachable subscriber */
+            syslog(LOG_ERR, "sendmmsg failed: %s (%d)\n", strerror(errno), errno);
+            sent = 1;
+        }
+        done += sent;
+    }
+
+    return count;
+}
+
+void udp_close(struct UdpRelay *udp)
+{
+    if (udp->sock >= 0)
+        close(udp->sock);
+    udp->sock = -1;
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "wire.h"
+
+/* FRAME_CONTROL and FRAME_PRIORITY are the top two bits of the length word */
+static uint32_t frame_flags(uint64_t type, uint64_t flags)
+{
+    return (uint32_t)(type & WIRE_TYPE_CONTROL) << 31 | (uint32_t)(flags & WIRE_FLAG_PRIORITY) << 30;
+}
+
+static int parse_fixed(const char *buf, size_t avail, size_t size, struct FrameView *view)
+{
+    struct WireFixedHeader header;
+
+    if (avail < WIRE_FIXED_SIZE)
+        return 0;
+    wire_fixed_decode((const unsigned char *)buf, &header);
+    if (header.version != WIRE_VERSION_FIXED || header.length > size - WIRE_FIXED_SIZE)
+        return -1;
+    if (avail - WIRE_FIXED_SIZE < header.length)
+        return 0;
+
+    view->msg = buf + WIRE_FIXED_SIZE;
+    view->len = header.length;
+    view->flags = frame_flags(header.type, header.flags);
+    return WIRE_FIXED_SIZE + header.length;
+}
+
+static int parse_compact(const char *buf, size_t avail, size_t size, struct FrameView *view)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    struct WireCompactHeader header;
+    unsigned char tail[8];
+    uint64_t len;
+    int n;
+
+    if (avail < WIRE_COMPACT_SIZE + 1)
+        return 0;
+    wire_compact_decode(p, &header);
+    if (header.tag >> 4 != WIRE_VERSION_COMPACT)
+        return -1;
+
+    /* The decoder reads 8 bytes, only the last frame in the buffer needs copying */
+    p += WIRE_COMPACT_SIZE;
+    if (avail - WIRE_COMPACT_SIZE < sizeof(tail))
+    {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p, avail - WIRE_COMPACT_SIZE);
+        p = tail;
+    }
+    n = wire_varint_decode(p, &len);
+    if (n < 0 || len > size - WIRE_COMPACT_SIZE - n)
+        return -1;
+    if (avail - WIRE_COMPACT_SIZE < (size_t)n || avail - WIRE_COMPACT_SIZE - n < len)
+        return 0;
+
+    view->msg = buf + WIRE_COMPACT_SIZE + n;
+    view->len = len;
+    view->flags = frame_flags(header.tag >> 1, header.tag);
+    return WIRE_COMPACT_SIZE + n + len;
+}
+
+/*
+ * frame_parse() for a relay's framing: decode the frame at the start of a
+ * buffer of size bytes holding avail. Returns the bytes it occupies once it
+ * is complete, 0 while more data is needed, or -1 if it can never fit the
+ * buffer or is not in the framing at all.
+ */
+int wire_parse(int format, const char *buf, size_t avail, size_t size, struct FrameView *view)
+{
+    switch (format)
+    {
+    case WIRE_FIXED:
+        return parse_fixed(buf, avail, size, view);
+    case WIRE_COMPACT:
+        return parse_compact(buf, avail, size, view);
+    default:
+        return frame_parse(buf, avail, size - 4, view);
+    }
+}
+
+/*
+ * Write the header of a frame of len payload bytes with frame flags, the
+ * sequence-th frame on its connection. Returns the header's size.
+ */
+size_t wire_header(int format, unsigned char *header, uint32_t len, uint32_t flags, uint64_t sequence)
+{
+    struct WireCompactHeader compact;
+    struct WireFixedHeader fixed;
+    uint32_t word;
+
+    switch (format)
+    {
+    case WIRE_FIXED:
+        fixed.version = WIRE_VERSION_FIXED;
+        fixed.type = (flags & FRAME_CONTROL) ? WIRE_TYPE_CONTROL : WIRE_TYPE_DATA;
+        fixed.flags = (flags & FRAME_PRIORITY) ? WIRE_FLAG_PRIORITY : 0;
+        fixed.length = len;
+        fixed.channel = 0;
+        fixed.sequence = sequence;
+        wire_fixed_encode(header, &fixed);
+        return WIRE_FIXED_SIZE;
+    case WIRE_COMPACT:
+        compact.tag = WIRE_VERSION_COMPACT << 4 | ((flags & FRAME_CONTROL) ? WIRE_TYPE_CONTROL << 1 : 0) |
+                      ((flags & FRAME_PRIORITY) ? WIRE_FLAG_PRIORITY : 0);
+        wire_compact_encode(header, &compact);
+        return WIRE_COMPACT_SIZE + wire_varint_encode(header + WIRE_COMPACT_SIZE, len);
+    default:
+        word = len | (flags & ~FRAME_LENGTH_MASK);
+        wire_store(header, word, 4);
+        return 4;
+    }
+}
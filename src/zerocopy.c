@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "zerocopy.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/* Turn zero copy on for sends of at least min bytes, if the kernel has it */
+int zc_enable(struct ZeroCopy *zc, int sockfd, size_t min)
+{
+    int one = 1;
+
+    memset(zc, 0, sizeof(*zc));
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+        return -1;
+    zc->pending = malloc(ZC_MAX_PENDING * sizeof(struct ZcEntry));
+    if (zc->pending == NULL)
+        return -1;
+    zc->min = min;
+    return 0;
+}
+
+/* Whether a send of bytes spread over frames should go out zero-copy */
+int zc_want(const struct ZeroCopy *zc, size_t bytes, unsigned int frames)
+{
+    return zc->min > 0 && bytes >= zc->min && zc->count + frames <= ZC_MAX_PENDING;
+}
+
+/* Hold frames until the zero-copy send just made is reported finished */
+void zc_track(struct ZeroCopy *zc, struct Frame *const *frames, unsigned int count)
+{
+    struct ZcEntry *entry;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        entry = &zc->pending[(zc->head + zc->count++) % ZC_MAX_PENDING];
+        entry->id = zc->next_id;
+        entry->done = 0;
+        entry->frame = frame_ref(frames[i]);
+    }
+    zc->next_id++;
+}
+
+/* Mark sends lo..hi finished and release frames from the oldest on */
+static void zc_complete(struct ZeroCopy *zc, uint32_t lo, uint32_t hi)
+{
+    struct ZcEntry *entry;
+    unsigned int i;
+
+    for (i = 0; i < zc->count; i++)
+    {
+        entry = &zc->pending[(zc->head + i) % ZC_MAX_PENDING];
+        if (entry->id - lo <= hi - lo)
+            entry->done = 1;
+    }
+    while (zc->count > 0 && zc->pending[zc->head].done)
+    {
+        frame_unref(zc->pending[zc->head].frame);
+        zc->head = (zc->head + 1) % ZC_MAX_PENDING;
+        zc->count--;
+    }
+}
+
+/*
+ * Drain the completion notifications queued on sockfd's error queue.
+ * Returns 0, or -1 if reading the queue failed.
+ */
+int zc_reap(struct ZeroCopy *zc, int sockfd)
+{
+    char control[128];
+    struct sock_extended_err *err;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            syslog(LOG_ERR, "zerocopy completion failed: %s (%d)\n", strerror(errno), errno);
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* The kernel had to copy anyway, e.g. on loopback: stop pinning */
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->min = 0;
+            zc_complete(zc, err->ee_info, err->ee_data);
+        }
+    }
+}
+
+void zc_clear(struct ZeroCopy *zc)
+{
+    while (zc->count > 0)
+    {
+        frame_unref(zc->pending[zc->head].frame);
+        zc->head = (zc->head + 1) % ZC_MAX_PENDING;
+        zc->count--;
+    }
+    free(zc->pending);
+    memset(zc, 0, sizeof(*zc));
+}
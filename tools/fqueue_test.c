@@ -0,0 +1,206 @@
+/*
+ * Tests for the frame queue: sizes, empty batches, filling, wrapping and
+ * order on one thread, then every handle pushed by several producers popped
+ * exactly once by several consumers, for each combination of single-thread
+ * flags the relay may use.
+ *
+ *   make check
+ */
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "fqueue.h"
+#include "check.h"
+
+#define QUEUE_SIZE 8
+#define THREAD_FRAMES 100000
+#define MAX_THREADS 4
+
+struct Side
+{
+    struct FrameQueue *queue;
+    uint64_t first; /* Producers push first .. first + THREAD_FRAMES - 1 */
+    uint64_t total; /* Consumers stop once this many were popped among them */
+    uint64_t *popped;
+    uint64_t sum;
+    uint64_t count;
+};
+
+static struct Frame *handle(uint64_t n)
+{
+    return (struct Frame *)(uintptr_t)n;
+}
+
+static void test_init(void)
+{
+    struct FrameQueue queue;
+
+    CHECK(fq_init(&queue, 0, 0) == -1);
+    CHECK(fq_init(&queue, 1, 0) == -1);
+    CHECK(fq_init(&queue, 6, 0) == -1);
+    CHECK(fq_init(&queue, 2, 0) == 0);
+    fq_free(&queue);
+}
+
+static void test_empty_batch(void)
+{
+    struct FrameQueue queue;
+    struct Frame *frames[2] = {handle(1), handle(2)};
+    struct Frame *out[2];
+
+    CHECK(fq_init(&queue, QUEUE_SIZE, 0) == 0);
+    CHECK(fq_push(&queue, frames, 0) == 0);
+    CHECK(fq_pop(&queue, out, 0) == 0);
+    CHECK(fq_empty(&queue));
+    CHECK(fq_push(&queue, frames, 2) == 2);
+    CHECK(fq_push(&queue, frames, 0) == 0);
+    CHECK(fq_pop(&queue, out, 0) == 0);
+    CHECK(fq_pop(&queue, out, 2) == 2);
+    CHECK(out[0] == handle(1) && out[1] == handle(2));
+    fq_free(&queue);
+}
+
+static void test_fill_and_wrap(int flags)
+{
+    struct FrameQueue queue;
+    struct Frame *frames[QUEUE_SIZE * 2];
+    struct Frame *out[QUEUE_SIZE * 2];
+    uint64_t next = 1;
+    uint64_t expect = 1;
+    unsigned int n;
+    unsigned int i;
+    int round;
+
+    CHECK(fq_init(&queue, QUEUE_SIZE, flags) == 0);
+    CHECK(fq_empty(&queue));
+    CHECK(fq_pop(&queue, out, 1) == 0);
+
+    /* A batch larger than the room left is cut short, the rest does not fit */
+    for (i = 0; i < QUEUE_SIZE * 2; i++)
+        frames[i] = handle(next + i);
+    CHECK(fq_push(&queue, frames, 5) == 5);
+    CHECK(fq_push(&queue, frames + 5, 5) == QUEUE_SIZE - 5);
+    CHECK(fq_push(&queue, frames, 1) == 0);
+    CHECK(!fq_empty(&queue));
+    next += QUEUE_SIZE;
+    CHECK(fq_pop(&queue, out, QUEUE_SIZE * 2) == QUEUE_SIZE);
+    for (i = 0; i < QUEUE_SIZE; i++)
+        CHECK(out[i] == handle(expect++));
+    CHECK(fq_empty(&queue));
+
+    /* Uneven batches carry the positions round the ring many times, in order */
+    for (round = 0; round < 1000; round++)
+    {
+        n = round % 5 + 1;
+        for (i = 0; i < n; i++)
+            frames[i] = handle(next + i);
+        n = fq_push(&queue, frames, n);
+        next += n;
+        n = fq_pop(&queue, out, round % 3 + 1);
+        for (i = 0; i < n; i++)
+            CHECK(out[i] == handle(expect++));
+    }
+    while ((n = fq_pop(&queue, out, QUEUE_SIZE)) > 0)
+    {
+        for (i = 0; i < n; i++)
+            CHECK(out[i] == handle(expect++));
+    }
+    CHECK(expect == next);
+    fq_free(&queue);
+}
+
+static void *produce(void *arg)
+{
+    struct Side *side = arg;
+    struct Frame *frames[3];
+    uint64_t next = side->first;
+    uint64_t end = side->first + THREAD_FRAMES;
+    unsigned int n;
+    unsigned int i;
+
+    while (next < end)
+    {
+        n = end - next < 3 ? end - next : 3;
+        for (i = 0; i < n; i++)
+            frames[i] = handle(next + i);
+        n = fq_push(side->queue, frames, n);
+        next += n;
+        if (n == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    struct Side *side = arg;
+    struct Frame *out[4];
+    unsigned int n;
+    unsigned int i;
+
+    while (__atomic_load_n(side->popped, __ATOMIC_RELAXED) < side->total)
+    {
+        n = fq_pop(side->queue, out, 4);
+        if (n == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < n; i++)
+            side->sum += (uintptr_t)out[i];
+        side->count += n;
+        __atomic_add_fetch(side->popped, n, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void test_threads(int producers, int consumers, int flags)
+{
+    struct FrameQueue queue;
+    struct Side sides[MAX_THREADS * 2];
+    pthread_t threads[MAX_THREADS * 2];
+    uint64_t total = (uint64_t)producers * THREAD_FRAMES;
+    uint64_t popped = 0;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    int i;
+
+    CHECK(fq_init(&queue, QUEUE_SIZE, flags) == 0);
+    for (i = 0; i < producers + consumers; i++)
+    {
+        sides[i].queue = &queue;
+        sides[i].first = (uint64_t)i * THREAD_FRAMES + 1;
+        sides[i].total = total;
+        sides[i].popped = &popped;
+        sides[i].sum = 0;
+        sides[i].count = 0;
+        CHECK(pthread_create(&threads[i], NULL, i < producers ? produce : consume, &sides[i]) == 0);
+    }
+    for (i = 0; i < producers + consumers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        sum += sides[i].sum;
+        count += sides[i].count;
+    }
+
+    /* Handles 1 .. total, each popped once */
+    CHECK(count == total);
+    CHECK(sum == total * (total + 1) / 2);
+    CHECK(fq_empty(&queue));
+    fq_free(&queue);
+}
+
+int main(void)
+{
+    test_init();
+    test_empty_batch();
+    test_fill_and_wrap(0);
+    test_fill_and_wrap(FQ_SINGLE_PRODUCER | FQ_SINGLE_CONSUMER);
+    test_threads(1, 1, FQ_SINGLE_PRODUCER | FQ_SINGLE_CONSUMER);
+    test_threads(MAX_THREADS, 1, FQ_SINGLE_CONSUMER);
+    test_threads(1, MAX_THREADS, FQ_SINGLE_PRODUCER);
+    test_threads(MAX_THREADS / 2, MAX_THREADS / 2, 0);
+    printf("fqueue_test: ok\n");
+    return 0;
+}
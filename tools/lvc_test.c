@@ -0,0 +1,195 @@
+/*
+ * Tests for the last-value cache and conflation: a key keeps one slot and
+ * its newest frame, unkeyed frames and a full cache are refused, and a
+ * lagging client's conflate set hands out each changed key once, so that
+ * a burst of updates reaches it as the newest value of every key. Frame
+ * references are counted throughout and must all be released at the end.
+ *
+ *   make check
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "lvc.h"
+#include "check.h"
+
+#define CACHE_SLOTS 16
+
+/* Every frame the tests make is charged here, so a leaked one shows */
+static struct FrameMemory *memory;
+
+static struct Frame *charged(struct Frame *frame)
+{
+    CHECK(frame != NULL);
+    frame_charge(frame, memory);
+    return frame;
+}
+
+/* A conflation mode payload: key length, key, then the value */
+static struct Frame *keyed(const char *key, const char *value)
+{
+    char msg[256];
+    size_t key_len = strlen(key);
+    size_t value_len = strlen(value);
+
+    msg[0] = (char)key_len;
+    memcpy(msg + 1, key, key_len);
+    memcpy(msg + 1 + key_len, value, value_len);
+    return charged(frame_new(msg, 1 + key_len + value_len, 0));
+}
+
+/* Whether frame carries value after its key */
+static int has_value(const struct Frame *frame, const char *value)
+{
+    size_t start = 5 + (unsigned char)frame->data[4];
+
+    return frame->len - start == strlen(value) && memcmp(frame->data + start, value, strlen(value)) == 0;
+}
+
+static void test_put(void)
+{
+    struct Lvc lvc;
+    struct Frame *a1 = keyed("a", "1");
+    struct Frame *a2 = keyed("a", "2");
+    struct Frame *b1 = keyed("b", "1");
+    struct Frame *unkeyed = charged(frame_new("\0value", 6, 0));
+    struct Frame *empty = charged(frame_new("", 0, 0));
+    struct Frame *overlong = charged(frame_new("\x09short", 6, 0));
+    int slot_a;
+    int slot_b;
+
+    CHECK(lvc_init(&lvc, CACHE_SLOTS) == 0);
+    slot_a = lvc_put(&lvc, a1);
+    CHECK(slot_a >= 0 && slot_a < CACHE_SLOTS);
+    CHECK(lvc.slots[slot_a].value == a1 && a1->refs == 2);
+    slot_b = lvc_put(&lvc, b1);
+    CHECK(slot_b >= 0 && slot_b != slot_a);
+
+    /* A newer value takes the key's slot over and releases the old frame */
+    CHECK(lvc_put(&lvc, a2) == slot_a);
+    CHECK(lvc.slots[slot_a].value == a2 && a2->refs == 2);
+    CHECK(a1->refs == 1);
+    CHECK(lvc.count == 2);
+
+    /* Only frames that carry a key whole are cached */
+    CHECK(lvc_put(&lvc, unkeyed) == -1);
+    CHECK(lvc_put(&lvc, empty) == -1);
+    CHECK(lvc_put(&lvc, overlong) == -1);
+    CHECK(lvc.count == 2);
+
+    lvc_free(&lvc);
+    CHECK(a2->refs == 1 && b1->refs == 1);
+    frame_unref(a1);
+    frame_unref(a2);
+    frame_unref(b1);
+    frame_unref(unkeyed);
+    frame_unref(empty);
+    frame_unref(overlong);
+}
+
+static void test_full(void)
+{
+    struct Lvc lvc;
+    struct Frame *frame;
+    char key[16];
+    int slots[CACHE_SLOTS];
+    int i;
+
+    /* New keys are refused at three quarters full, known keys still update */
+    CHECK(lvc_init(&lvc, CACHE_SLOTS) == 0);
+    for (i = 0; i < CACHE_SLOTS / 4 * 3; i++)
+    {
+        snprintf(key, sizeof(key), "k%d", i);
+        frame = keyed(key, "old");
+        slots[i] = lvc_put(&lvc, frame);
+        CHECK(slots[i] >= 0);
+        frame_unref(frame);
+    }
+    frame = keyed("another", "x");
+    CHECK(lvc_put(&lvc, frame) == -1);
+    frame_unref(frame);
+    for (i = 0; i < CACHE_SLOTS / 4 * 3; i++)
+    {
+        snprintf(key, sizeof(key), "k%d", i);
+        frame = keyed(key, "new");
+        CHECK(lvc_put(&lvc, frame) == slots[i]);
+        frame_unref(frame);
+        CHECK(has_value(lvc.slots[slots[i]].value, "new"));
+    }
+    CHECK(lvc.count == CACHE_SLOTS / 4 * 3);
+    lvc_free(&lvc);
+}
+
+static void test_conflate(void)
+{
+    static const char *keys[] = {"x", "y", "z"};
+    struct ConflateSet set;
+    struct Lvc lvc;
+    struct Frame *frame;
+    char value[16];
+    int seen[CACHE_SLOTS];
+    int slot;
+    int popped;
+    int i;
+
+    CHECK(lvc_init(&lvc, CACHE_SLOTS) == 0);
+    memset(&set, 0, sizeof(set));
+    CHECK(conflate_pop(&set, &lvc) == -1);
+
+    /* A client that cannot keep up is marked on every update */
+    for (i = 0; i < 1000; i++)
+    {
+        snprintf(value, sizeof(value), "%d", i);
+        frame = keyed(keys[i % 3], value);
+        slot = lvc_put(&lvc, frame);
+        frame_unref(frame);
+        CHECK(slot >= 0);
+        CHECK(conflate_mark(&set, &lvc, slot) == 0);
+    }
+    CHECK(set.count == 3);
+
+    /* Once it catches up, it gets each key once, with the newest value */
+    memset(seen, 0, sizeof(seen));
+    for (popped = 0; (slot = conflate_pop(&set, &lvc)) >= 0; popped++)
+    {
+        CHECK(!seen[slot]);
+        seen[slot] = 1;
+        frame = lvc.slots[slot].value;
+        CHECK(frame->data[5] != 'x' || has_value(frame, "999"));
+        CHECK(frame->data[5] != 'y' || has_value(frame, "997"));
+        CHECK(frame->data[5] != 'z' || has_value(frame, "998"));
+    }
+    CHECK(popped == 3);
+
+    /* A popped key may be marked again, a snapshot marks every cached key */
+    frame = keyed("x", "1000");
+    slot = lvc_put(&lvc, frame);
+    frame_unref(frame);
+    CHECK(conflate_mark(&set, &lvc, slot) == 0);
+    CHECK(conflate_pop(&set, &lvc) == slot);
+    CHECK(conflate_pop(&set, &lvc) == -1);
+    CHECK(conflate_mark(&set, &lvc, slot) == 0);
+    CHECK(conflate_snapshot(&set, &lvc) == 0);
+    CHECK(set.count == lvc.count);
+    for (popped = 0; conflate_pop(&set, &lvc) >= 0; popped++)
+        ;
+    CHECK(popped == 3);
+
+    conflate_clear(&set);
+    CHECK(set.ring == NULL && set.count == 0);
+    lvc_free(&lvc);
+}
+
+int main(void)
+{
+    memory = frame_memory_new();
+    CHECK(memory != NULL);
+    test_put();
+    test_full();
+    test_conflate();
+    CHECK(frame_memory(memory) == 0);
+    CHECK(memory->refs == 1);
+    frame_memory_release(memory);
+    printf("lvc_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Tests that relays in one process keep separate memory budgets: frames
+ * queued on one relay behind a long coalescing window are charged to that
+ * relay only, so a second relay with a budget smaller than that backlog
+ * still accepts, reads and relays. Both relays are stepped from this
+ * thread, between the test's own socket calls.
+ *
+ *   make check
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "relay.h"
+#include "outq.h"
+#include "check.h"
+
+#define FRAME_PAYLOAD (16 * 1024)
+#define BACKLOG_FRAMES 128
+#define STEPS 2000
+
+/* A port nothing listens on, for a relay to bind */
+static int free_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(sock >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(getsockname(sock, (struct sockaddr *)&addr, &len) == 0);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+static struct Relay *start(int port, size_t mem_limit, uint64_t window_ns)
+{
+    struct RelayConfig config;
+    struct Relay *relay;
+
+    relay_config_init(&config);
+    config.port = port;
+    config.memLimit = mem_limit;
+    config.window.ns = window_ns;
+    config.window.bytes = OUTQ_MAX_BYTES - FRAME_BUFFER_SIZE;
+    relay = relay_new(&config, NULL);
+    CHECK(relay != NULL);
+    CHECK(relay_listen(relay) == 0);
+    return relay;
+}
+
+static int dial(int port)
+{
+    struct sockaddr_in addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(sock >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    CHECK(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(fcntl(sock, F_SETFL, O_NONBLOCK) == 0);
+    return sock;
+}
+
+static void step(struct Relay *a, struct Relay *b, int passes)
+{
+    while (passes-- > 0)
+    {
+        CHECK(relay_run_once(a, 1) == 0);
+        CHECK(relay_run_once(b, 1) == 0);
+    }
+}
+
+/* Write all of buf to a non-blocking socket, running both relays while it is full */
+static void send_all(struct Relay *a, struct Relay *b, int sock, const char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+    int steps;
+
+    for (steps = 0; done < len && steps < STEPS; steps++)
+    {
+        n = send(sock, buf + done, len - done, MSG_NOSIGNAL);
+        if (n > 0)
+            done += n;
+        else
+            CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+        step(a, b, 1);
+    }
+    CHECK(done == len);
+}
+
+int main(void)
+{
+    static char frame[4 + FRAME_PAYLOAD];
+    static const char hello[] = "\0\0\0\5hello";
+    char got[sizeof(hello)];
+    struct Relay *busy;
+    struct Relay *tight;
+    int busy_port = free_port();
+    int tight_port = free_port();
+    int waiting;
+    int publisher;
+    int subscriber;
+    int got_len = 0;
+    ssize_t n;
+    int steps;
+    int i;
+
+    busy = start(busy_port, 0, 60 * 1000000000ull);
+    tight = start(tight_port, 1024 * 1024, 0);
+
+    /* The busy relay holds 2MB for a subscriber until its window closes */
+    waiting = dial(busy_port);
+    publisher = dial(busy_port);
+    step(busy, tight, 10);
+    frame[1] = (char)(FRAME_PAYLOAD >> 16);
+    frame[2] = (char)(FRAME_PAYLOAD >> 8);
+    frame[3] = (char)FRAME_PAYLOAD;
+    for (i = 0; i < BACKLOG_FRAMES; i++)
+        send_all(busy, tight, publisher, frame, sizeof(frame));
+    step(busy, tight, 10);
+    close(publisher);
+
+    /* The tight relay, with a budget half that, is not held to it */
+    subscriber = dial(tight_port);
+    publisher = dial(tight_port);
+    step(busy, tight, 10);
+    send_all(busy, tight, publisher, hello, sizeof(hello) - 1);
+    for (steps = 0; steps < STEPS && got_len < (int)sizeof(hello) - 1; steps++)
+    {
+        step(busy, tight, 1);
+        n = recv(subscriber, got + got_len, sizeof(got) - got_len, 0);
+        if (n > 0)
+            got_len += n;
+    }
+    CHECK(got_len == sizeof(hello) - 1);
+    CHECK(memcmp(got, hello, got_len) == 0);
+
+    close(publisher);
+    close(subscriber);
+    close(waiting);
+    relay_free(busy);
+    relay_free(tight);
+    printf("memory_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Throughput of the frame parser across frame size mixes and the way bytes
+ * arrive from the socket. Each run replays a pre-built stream through a
+ * client-sized receive buffer exactly as the relay loop does: append a
+ * chunk, parse every complete frame, compact once. Every wire format is
+ * measured.
+ *
+ *   make bench && ./parser_bench [megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+#include "wire.h"
+
+static const char *const formats[] = {"legacy", "fixed", "compact"};
+
+struct SizeMix
+{
+    const char *name;
+    uint32_t min;
+    uint32_t max;
+};
+
+struct Chunking
+{
+    const char *name;
+    size_t min;
+    size_t max;
+};
+
+static const struct SizeMix mixes[] = {
+    {"tiny 8-32", 8, 32},
+    {"small 64-256", 64, 256},
+    {"mixed 16-4k", 16, 4096},
+    {"large 8k-32k", 8192, 32768},
+};
+
+static const struct Chunking chunkings[] = {
+    {"buffer", 0, 0},
+    {"mtu 1448", 1448, 1448},
+    {"random 1-64", 1, 64},
+};
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)rng;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t build_stream(char *stream, size_t size, int format, const struct SizeMix *mix, size_t *frames)
+{
+    size_t pos = 0;
+    size_t header;
+    uint32_t len;
+
+    *frames = 0;
+    for (;;)
+    {
+        len = mix->min + next_random() % (mix->max - mix->min + 1);
+        if (pos + WIRE_MAX_HEADER + len > size)
+            return pos;
+        header = wire_header(format, (unsigned char *)stream + pos, len, 0, *frames);
+        memset(stream + pos + header, 'x', len);
+        pos += header + len;
+        (*frames)++;
+    }
+}
+
+static void run(const char *stream, size_t size, size_t frames, int format, const struct SizeMix *mix,
+                const struct Chunking *chunking)
+{
+    static char buffer[FRAME_BUFFER_SIZE];
+    struct FrameView view;
+    uint64_t checksum = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    size_t parsed = 0;
+    size_t in = 0;
+    size_t pos = 0;
+    size_t consumed;
+    size_t chunk;
+    int result;
+
+    start = now_ns();
+    while (in < size)
+    {
+        /* What one recv() would return */
+        chunk = sizeof(buffer) - pos;
+        if (chunking->max != 0 && chunk > chunking->min + next_random() % (chunking->max - chunking->min + 1))
+            chunk = chunking->min + next_random() % (chunking->max - chunking->min + 1);
+        if (chunk > size - in)
+            chunk = size - in;
+        memcpy(buffer + pos, stream + in, chunk);
+        in += chunk;
+        pos += chunk;
+
+        consumed = 0;
+        while ((result = wire_parse(format, buffer + consumed, pos - consumed, sizeof(buffer), &view)) > 0)
+        {
+            checksum += view.len;
+            consumed += result;
+            parsed++;
+        }
+        if (result < 0)
+        {
+            fprintf(stderr, "parse error\n");
+            exit(1);
+        }
+        pos = frame_compact(buffer, pos, consumed);
+    }
+    elapsed = now_ns() - start;
+
+    if (parsed != frames)
+    {
+        fprintf(stderr, "parsed %zu of %zu frames\n", parsed, frames);
+        exit(1);
+    }
+    printf("%-8s %-14s %-12s %12.0f frames/s %8.1f ns/frame %8.0f MB/s  (%llu)\n",
+           formats[format], mix->name, chunking->name, frames * 1e9 / elapsed, (double)elapsed / frames,
+           size * 1e3 / elapsed, (unsigned long long)(checksum & 0xff));
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    size_t frames;
+    size_t used;
+    char *stream;
+    size_t m;
+    size_t c;
+    int f;
+
+    stream = malloc(size);
+    if (stream == NULL)
+    {
+        perror("malloc");
+        return 1;
+    }
+    for (f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++)
+    {
+        for (m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++)
+        {
+            used = build_stream(stream, size, f, &mixes[m], &frames);
+            for (c = 0; c < sizeof(chunkings) / sizeof(chunkings[0]); c++)
+                run(stream, used, frames, f, &mixes[m], &chunkings[c]);
+        }
+    }
+    free(stream);
+    return 0;
+}
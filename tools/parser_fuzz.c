@@ -0,0 +1,288 @@
+/*
+ * Fuzz target for the frame parsers. The first input byte picks how the
+ * rest is split into reads, its top two bits the framing: WIRE_FIXED,
+ * WIRE_COMPACT or else the 4-byte length word. The stream is then fed
+ * through a small receive buffer with frame_parse() or wire_parse() and
+ * frame_compact(), and every frame found is checked against a straight-line
+ * decode of the same bytes. For the versioned framings every parse is held
+ * to the reference, so a wrong version, an overlong varint or a length too
+ * big for the buffer must be rejected and a truncated header waited on.
+ *
+ *   make fuzz && ./parser_fuzz corpus/        (libFuzzer, needs clang)
+ *   make fuzz-smoke && ./parser_fuzz [files]  (gcc + sanitizers, random inputs if no files)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "wire.h"
+
+#define FUZZ_BUFFER 512
+
+static uint32_t read_word(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * What wire_parse() must make of avail bytes at p in a buffer of size bytes:
+ * the frame's size with its header length, payload length and flags filled
+ * in, 0 while more is needed, or -1 if it is not in the framing or too big.
+ */
+static int wire_reference(int format, const uint8_t *p, size_t avail, size_t size, size_t *header, uint32_t *len,
+                          uint32_t *flags)
+{
+    uint64_t word = 0;
+    size_t n;
+    size_t i;
+
+    if (format == WIRE_FIXED)
+    {
+        if (avail < 20)
+            return 0;
+        if (p[0] != WIRE_VERSION_FIXED)
+            return -1;
+        *header = 20;
+        *len = read_word(p + 4);
+        *flags = (uint32_t)(p[1] & 1) << 31 | (uint32_t)(p[3] & 1) << 30;
+    }
+    else
+    {
+        /* Tag, then as many length bytes as trailing zeros in the first one plus one */
+        if (avail < 2)
+            return 0;
+        if (p[0] >> 4 != WIRE_VERSION_COMPACT)
+            return -1;
+        for (n = 1; n <= 8 && !(p[1] & (1 << (n - 1))); n++)
+            ;
+        if (n > 5)
+            return -1;
+        /* Bytes not yet arrived count as zero: the length can only grow */
+        for (i = 0; i < n && 1 + i < avail; i++)
+            word |= (uint64_t)p[1 + i] << (8 * i);
+        word >>= n;
+        if (word > size - 1 - n)
+            return -1;
+        if (avail < 1 + n)
+            return 0;
+        *header = 1 + n;
+        *len = word;
+        *flags = (uint32_t)(p[0] >> 1 & 1) << 31 | (uint32_t)(p[0] & 1) << 30;
+    }
+    if (*len > size - *header)
+        return -1;
+    if (avail - *header < *len)
+        return 0;
+    return *header + *len;
+}
+
+/* Parse a WIRE_FIXED or WIRE_COMPACT stream and hold every result to wire_reference() */
+static int fuzz_wire(int format, size_t chunk_max, const uint8_t *data, size_t size)
+{
+    char buffer[FUZZ_BUFFER];
+    struct FrameView view;
+    size_t expect = 0;
+    size_t in = 0;
+    size_t pos = 0;
+    size_t consumed;
+    size_t header;
+    size_t chunk;
+    uint32_t flags;
+    uint32_t len;
+    int result;
+
+    while (in < size)
+    {
+        chunk = sizeof(buffer) - pos;
+        if (chunk > chunk_max)
+            chunk = chunk_max;
+        if (chunk > size - in)
+            chunk = size - in;
+        memcpy(buffer + pos, data + in, chunk);
+        in += chunk;
+        pos += chunk;
+
+        consumed = 0;
+        for (;;)
+        {
+            result = wire_parse(format, buffer + consumed, pos - consumed, sizeof(buffer), &view);
+            if (result != wire_reference(format, (const uint8_t *)buffer + consumed, pos - consumed, sizeof(buffer), &header,
+                                         &len, &flags))
+                abort();
+            if (result <= 0)
+                break;
+            if (view.len != len || view.flags != flags || consumed + result > pos || view.msg != buffer + consumed + header ||
+                memcmp(buffer + consumed, data + expect, result) != 0)
+                abort();
+            expect += result;
+            consumed += result;
+        }
+        if (result < 0)
+            return 0;
+        pos = frame_compact(buffer, pos, consumed);
+        if (pos != in - expect)
+            abort();
+    }
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char buffer[FUZZ_BUFFER];
+    struct FrameView view;
+    size_t chunk_max;
+    size_t expect = 0;
+    size_t in = 0;
+    size_t pos = 0;
+    size_t consumed;
+    size_t chunk;
+    uint32_t word;
+    int format;
+    int result;
+
+    if (size < 1)
+        return 0;
+    chunk_max = data[0] % 64 + 1;
+    format = data[0] >> 6;
+    data++;
+    size--;
+    if (format == WIRE_FIXED || format == WIRE_COMPACT)
+        return fuzz_wire(format, chunk_max, data, size);
+
+    while (in < size)
+    {
+        chunk = sizeof(buffer) - pos;
+        if (chunk > chunk_max)
+            chunk = chunk_max;
+        if (chunk > size - in)
+            chunk = size - in;
+        memcpy(buffer + pos, data + in, chunk);
+        in += chunk;
+        pos += chunk;
+
+        consumed = 0;
+        while ((result = frame_parse(buffer + consumed, pos - consumed, sizeof(buffer) - 4, &view)) > 0)
+        {
+            /* The frame must be exactly the next one in the input */
+            word = read_word(data + expect);
+            if (view.len != (word & FRAME_LENGTH_MASK) || view.flags != (word & ~FRAME_LENGTH_MASK) ||
+                (size_t)result != 4 + view.len || consumed + result > pos ||
+                view.msg != buffer + consumed + 4 || memcmp(view.msg, data + expect + 4, view.len) != 0)
+                abort();
+            expect += result;
+            consumed += result;
+        }
+        if (result < 0)
+        {
+            /* Only an oversized length may be rejected */
+            if ((read_word(data + expect) & FRAME_LENGTH_MASK) <= sizeof(buffer) - 4)
+                abort();
+            return 0;
+        }
+        pos = frame_compact(buffer, pos, consumed);
+        if (pos != in - expect)
+            abort();
+    }
+    return 0;
+}
+
+#ifdef PARSER_FUZZ_MAIN
+int main(int argc, char *argv[])
+{
+    uint8_t input[4096];
+    uint64_t rng = 88172645463325252ull;
+    size_t header;
+    size_t size;
+    size_t len;
+    size_t i;
+    FILE *f;
+    int format;
+    int n;
+
+    for (n = 1; n < argc; n++)
+    {
+        f = fopen(argv[n], "rb");
+        if (f == NULL)
+        {
+            perror(argv[n]);
+            return 1;
+        }
+        size = fread(input, 1, sizeof(input), f);
+        fclose(f);
+        LLVMFuzzerTestOneInput(input, size);
+    }
+    if (argc > 1)
+        return 0;
+
+    /* Random streams of small frames, lengths biased to stay parseable */
+    for (n = 0; n < 200000; n++)
+    {
+        size = 0;
+        input[size++] = (uint8_t)n;
+        while (size + 4 < sizeof(input))
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            input[size] = (rng & 0xff) < 8 ? (uint8_t)(rng >> 8) : (uint8_t)((rng >> 8) & 0xc0);
+            input[size + 1] = 0;
+            input[size + 2] = (rng & 0x300) == 0 ? (uint8_t)(rng >> 16) & 0x3 : 0;
+            input[size + 3] = (uint8_t)(rng >> 24);
+            size += 4;
+            for (i = (rng >> 24) & 0x3f; i > 0 && size < sizeof(input); i--)
+                input[size++] = (uint8_t)(rng >> (i % 56));
+            if ((rng >> 40) % 16 == 0)
+                break;
+        }
+        LLVMFuzzerTestOneInput(input, size);
+    }
+
+    /* Versioned framings written by wire_header(), some headers broken on purpose */
+    for (; n < 400000; n++)
+    {
+        format = n % 2 ? WIRE_COMPACT : WIRE_FIXED;
+        size = 0;
+        input[size++] = (uint8_t)(format << 6 | (n & 0x3f));
+        for (;;)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            /* Mostly small frames, now and then one too big for the buffer */
+            len = (rng & 0xff) < 8 ? (rng >> 8) & 0x3ff : (rng >> 8) & 0x3f;
+            if (size + WIRE_MAX_HEADER + len > sizeof(input))
+                break;
+            header = wire_header(format, input + size, len, (uint32_t)(rng >> 20) << 30, n);
+            switch ((rng >> 32) % 32)
+            {
+            case 0:
+                /* Version mismatch */
+                input[size] ^= 0x30;
+                break;
+            case 1:
+                /* Varint of nine, eight or five bytes, the last too big for any buffer */
+                if (format == WIRE_COMPACT)
+                    input[size + 1] = (rng >> 40) % 3 == 0 ? 0x00 : (rng >> 40) % 3 == 1 ? 0x80 : 0xf0;
+                else
+                    input[size + 4] = 0xff;
+                break;
+            case 2:
+                /* The stream ends inside a header */
+                size += (rng >> 40) % header;
+                break;
+            }
+            if ((rng >> 32) % 32 == 2)
+                break;
+            size += header;
+            for (i = 0; i < len; i++)
+                input[size++] = (uint8_t)(rng >> (i % 56));
+            if ((rng >> 48) % 16 == 0)
+                break;
+        }
+        LLVMFuzzerTestOneInput(input, size);
+    }
+    printf("parser_fuzz: %d inputs ok\n", n);
+    return 0;
+}
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Throughput of the frame queue between threads, against a mutex-guarded
+ * ring as the baseline, for a few producer and consumer counts and batch
+ * sizes. Every handle pushed is popped exactly once, which is checked with
+ * a sum; producers spin while the queue is full, consumers while it is
+ * empty.
+ *
+ *   make queue-bench && ./queue_bench [millions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "fqueue.h"
+
+#define QUEUE_SIZE 1024
+#define MAX_THREADS 8
+#define MAX_BATCH 64
+
+struct Setup
+{
+    const char *name;
+    int producers;
+    int consumers;
+    unsigned int batch;
+    int flags;
+    int locked;
+};
+
+static const struct Setup setups[] = {
+    {"spsc", 1, 1, 1, FQ_SINGLE_PRODUCER | FQ_SINGLE_CONSUMER, 0},
+    {"spsc", 1, 1, 32, FQ_SINGLE_PRODUCER | FQ_SINGLE_CONSUMER, 0},
+    {"mpmc", 1, 1, 1, 0, 0},
+    {"mpmc", 2, 2, 1, 0, 0},
+    {"mpmc", 2, 2, 32, 0, 0},
+    {"mpmc", 4, 1, 1, 0, 0},
+    {"mpmc", 4, 1, 32, 0, 0},
+    {"mutex", 1, 1, 1, 0, 1},
+    {"mutex", 2, 2, 1, 0, 1},
+    {"mutex", 2, 2, 32, 0, 1},
+};
+
+/* The baseline: a plain ring behind one lock */
+static struct
+{
+    pthread_mutex_t lock;
+    struct Frame *slots[QUEUE_SIZE];
+    uint64_t head;
+    uint64_t tail;
+} ring = {PTHREAD_MUTEX_INITIALIZER, {0}, 0, 0};
+
+static struct FrameQueue queue;
+static const struct Setup *setup;
+static uint64_t per_producer;
+static uint64_t consumed;
+static uint64_t sum;
+
+static unsigned int ring_push(struct Frame *const *frames, unsigned int count)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&ring.lock);
+    for (n = 0; n < count && ring.head - ring.tail < QUEUE_SIZE; n++)
+        ring.slots[ring.head++ % QUEUE_SIZE] = frames[n];
+    pthread_mutex_unlock(&ring.lock);
+    return n;
+}
+
+static unsigned int ring_pop(struct Frame **frames, unsigned int count)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&ring.lock);
+    for (n = 0; n < count && ring.tail < ring.head; n++)
+        frames[n] = ring.slots[ring.tail++ % QUEUE_SIZE];
+    pthread_mutex_unlock(&ring.lock);
+    return n;
+}
+
+static void *producer(void *arg)
+{
+    struct Frame *frames[MAX_BATCH];
+    uint64_t next = (uint64_t)(uintptr_t)arg * per_producer + 1;
+    uint64_t end = next + per_producer;
+    unsigned int count;
+    unsigned int pushed;
+    unsigned int i;
+
+    while (next < end)
+    {
+        count = end - next < setup->batch ? end - next : setup->batch;
+        for (i = 0; i < count; i++)
+            frames[i] = (struct Frame *)(uintptr_t)(next + i);
+        for (i = 0; i < count; i += pushed)
+        {
+            pushed = setup->locked ? ring_push(frames + i, count - i) : fq_push(&queue, frames + i, count - i);
+            if (pushed == 0)
+                sched_yield();
+        }
+        next += count;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct Frame *frames[MAX_BATCH];
+    uint64_t total = per_producer * setup->producers;
+    uint64_t local = 0;
+    unsigned int n;
+    unsigned int i;
+
+    (void)arg;
+    while (__atomic_load_n(&consumed, __ATOMIC_RELAXED) < total)
+    {
+        n = setup->locked ? ring_pop(frames, setup->batch) : fq_pop(&queue, frames, setup->batch);
+        if (n == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < n; i++)
+            local += (uintptr_t)frames[i];
+        __atomic_fetch_add(&consumed, n, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&sum, local, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[MAX_THREADS];
+    uint64_t total = (argc > 1 ? strtoull(argv[1], NULL, 10) : 10) * 1000000;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t items;
+    size_t s;
+    int n;
+    int i;
+
+    printf("%-6s %9s %6s %12s %10s\n", "queue", "threads", "batch", "Mframes/s", "ns/frame");
+    for (s = 0; s < sizeof(setups) / sizeof(setups[0]); s++)
+    {
+        setup = &setups[s];
+        per_producer = total / setup->producers;
+        items = per_producer * setup->producers;
+        consumed = 0;
+        sum = 0;
+        ring.head = ring.tail = 0;
+        if (!setup->locked && fq_init(&queue, QUEUE_SIZE, setup->flags) != 0)
+            return 1;
+
+        start = now_ns();
+        n = 0;
+        for (i = 0; i < setup->consumers; i++)
+            pthread_create(&threads[n++], NULL, consumer, NULL);
+        for (i = 0; i < setup->producers; i++)
+            pthread_create(&threads[n++], NULL, producer, (void *)(uintptr_t)i);
+        for (i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        elapsed = now_ns() - start;
+
+        if (!setup->locked)
+            fq_free(&queue);
+        if (sum != items * (items + 1) / 2)
+        {
+            fprintf(stderr, "%s %d:%d lost or duplicated frames\n", setup->name, setup->producers, setup->consumers);
+            return 1;
+        }
+        printf("%-6s %7d:%-1d %6u %12.1f %10.1f\n", setup->name, setup->producers, setup->consumers, setup->batch,
+               items * 1e3 / elapsed, (double)elapsed / items);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Tests for the token bucket: a full burst to start with, refill at the
+ * configured rate up to the burst and no further, debt left by a charge
+ * larger than the burst paid off in the time bucket_wait() says, and no
+ * limit at all for a rate of 0. Time is passed in, so nothing sleeps.
+ *
+ *   make check
+ */
+#include <stdint.h>
+
+#include "ratelimit.h"
+#include "check.h"
+
+#define MS 1000000ull
+#define SECOND 1000000000ull
+
+/* Doubles built from rates and nanoseconds, equal to well within a token */
+static int near(double a, double b)
+{
+    return a - b < 1e-6 && b - a < 1e-6;
+}
+
+static void test_unlimited(void)
+{
+    struct TokenBucket bucket;
+
+    bucket_init(&bucket, 0, 0);
+    bucket_charge(&bucket, 1e9);
+    CHECK(bucket_ready(&bucket, 0));
+    CHECK(bucket_wait(&bucket, 0) == 0);
+}
+
+static void test_burst(void)
+{
+    struct TokenBucket bucket;
+    uint64_t now = 5 * SECOND;
+    int sent;
+
+    /* 1000 a second allows a burst of RATE_BURST_MS worth, 100 */
+    bucket_init(&bucket, 1000, now);
+    CHECK(near(bucket.burst, 1000.0 * RATE_BURST_MS / 1000));
+    for (sent = 0; bucket_ready(&bucket, now); sent++)
+        bucket_charge(&bucket, 1);
+    CHECK(sent == 100);
+    CHECK(bucket_wait(&bucket, now) > 0);
+
+    /* A slow rate still lets one through at a time */
+    bucket_init(&bucket, 2, now);
+    CHECK(near(bucket.burst, 1));
+    CHECK(bucket_ready(&bucket, now));
+    bucket_charge(&bucket, 1);
+    CHECK(!bucket_ready(&bucket, now));
+}
+
+static void test_refill(void)
+{
+    struct TokenBucket bucket;
+    uint64_t now = SECOND;
+    int sent;
+    int i;
+
+    bucket_init(&bucket, 1000, now);
+    bucket_charge(&bucket, bucket.burst);
+    CHECK(!bucket_ready(&bucket, now));
+
+    /* One token a millisecond */
+    CHECK(bucket_ready(&bucket, now + MS));
+    CHECK(near(bucket.tokens, 1));
+    CHECK(bucket_ready(&bucket, now + 11 * MS));
+    CHECK(near(bucket.tokens, 11));
+
+    /* A clock that steps back refills nothing */
+    CHECK(bucket_ready(&bucket, now));
+    CHECK(near(bucket.tokens, 11));
+
+    /* Idle time fills the bucket to the burst and no further */
+    CHECK(bucket_ready(&bucket, now + 60 * SECOND));
+    CHECK(near(bucket.tokens, bucket.burst));
+
+    /* Over a second of steady charging, the rate plus the burst get through */
+    now += 60 * SECOND;
+    sent = 0;
+    for (i = 0; i <= 1000; i++)
+    {
+        while (bucket_ready(&bucket, now + i * MS))
+        {
+            bucket_charge(&bucket, 1);
+            sent++;
+        }
+    }
+    CHECK(sent == 1000 + 100);
+}
+
+static void test_debt(void)
+{
+    struct TokenBucket bucket;
+    uint64_t now = SECOND;
+    uint64_t wait;
+
+    /* A frame of 250 against a burst of 100 still goes, then 150 ms of debt */
+    bucket_init(&bucket, 1000, now);
+    CHECK(bucket_ready(&bucket, now));
+    bucket_charge(&bucket, 250);
+    CHECK(!bucket_ready(&bucket, now));
+    wait = bucket_wait(&bucket, now);
+    CHECK(wait >= 150 * MS && wait <= 150 * MS + 1000);
+    CHECK(!bucket_ready(&bucket, now + 149 * MS));
+    CHECK(bucket_wait(&bucket, now + 149 * MS) <= MS + 1000);
+    CHECK(bucket_ready(&bucket, now + wait));
+    CHECK(bucket_wait(&bucket, now + wait) == 0);
+}
+
+int main(void)
+{
+    test_unlimited();
+    test_burst();
+    test_refill();
+    test_debt();
+    printf("ratelimit_test: ok\n");
+    return 0;
+}
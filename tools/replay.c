@@ -0,0 +1,451 @@
+/*
+ * Replay a capture made with daemonize -C against a running relay. Every
+ * client id in the capture gets a connection of its own and each frame is
+ * sent on it at its captured offset from the start, divided by the speed:
+ * 1 for real time, N for N times faster, 0 for as fast as the relay takes
+ * them. One more connection only listens; the data frames relayed to it are
+ * matched to their sends by payload to measure latency. Whatever the other
+ * connections are sent is read and discarded, so none of them lags.
+ *
+ *   make replay && ./replay [-a addr] [-p port] [-s speed] [-W format] capture
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+#include "wire.h"
+
+#define RX_BUFFER (4 * FRAME_BUFFER_SIZE)
+#define EVENTS 64
+/* Wait this long for relayed frames still in flight once everything is sent */
+#define SETTLE_NS 2000000000ull
+
+struct Record
+{
+    uint64_t at; /* ns since the start of the capture */
+    uint64_t id;
+    uint32_t word;
+    const char *payload;
+    int conn;
+    uint64_t sent_ns;
+    int next; /* Next send of the same payload, still awaiting its match */
+};
+
+/* Sends of one payload, by hash, oldest first */
+struct Pending
+{
+    uint64_t hash;
+    int head;
+    int tail;
+};
+
+static struct Record *records;
+static size_t record_count;
+static uint64_t *ids;
+static int *fds;
+static size_t conn_count;
+static int observer;
+static int format = WIRE_LEGACY;
+
+static struct Pending *pending;
+static size_t pending_mask;
+static uint64_t *latencies;
+static size_t matched;
+static size_t expected;
+
+static char rx[RX_BUFFER];
+static size_t rx_pos;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t payload_hash(const char *p, uint32_t len)
+{
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash | 1;
+}
+
+static struct Pending *find_pending(uint64_t hash)
+{
+    size_t i;
+
+    for (i = hash & pending_mask; pending[i].hash != 0 && pending[i].hash != hash; i = (i + 1) & pending_mask)
+        continue;
+    return &pending[i];
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Decode a varint that may sit in the last bytes of the file */
+static int read_varint(const unsigned char *p, const unsigned char *end, uint64_t *value)
+{
+    unsigned char tail[8];
+
+    if (end - p < 8)
+    {
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p, end - p);
+        p = tail;
+    }
+    return wire_varint_decode(p, value);
+}
+
+static int load(const char *path)
+{
+    const unsigned char *base;
+    const unsigned char *p;
+    const unsigned char *end;
+    struct stat st;
+    uint64_t gap;
+    uint64_t at = 0;
+    size_t cap = 0;
+    uint32_t len;
+    int n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (st.st_size < CAPTURE_MAGIC_SIZE + 8 || base == MAP_FAILED || memcmp(base, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: not a capture\n", path);
+        return -1;
+    }
+
+    end = base + st.st_size;
+    for (p = base + CAPTURE_MAGIC_SIZE + 8; p < end;)
+    {
+        if (record_count == cap)
+        {
+            cap = cap != 0 ? cap * 2 : 4096;
+            records = realloc(records, cap * sizeof(struct Record));
+            if (records == NULL)
+                return -1;
+        }
+        n = read_varint(p, end, &gap);
+        if (n < 0 || end - p < n)
+            break;
+        p += n;
+        n = read_varint(p, end, &records[record_count].id);
+        if (n < 0 || end - p < n + 4)
+            break;
+        p += n;
+        records[record_count].word = wire_load(p, 4);
+        len = records[record_count].word & FRAME_LENGTH_MASK;
+        p += 4;
+        if ((size_t)(end - p) < len)
+            break;
+        at += gap;
+        records[record_count].at = at;
+        records[record_count].payload = (const char *)p;
+        records[record_count].next = -1;
+        p += len;
+        record_count++;
+    }
+    if (p != end)
+        fprintf(stderr, "%s: truncated after %zu frames\n", path, record_count);
+    return 0;
+}
+
+static int dial(const char *addr, int port)
+{
+    struct sockaddr_in sin;
+    int one = 1;
+    int fd;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    inet_pton(AF_INET, addr, &sin.sin_addr);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+    {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+/* Match what the observer was relayed against the oldest send of each payload */
+static void observe(uint64_t now)
+{
+    struct FrameView view;
+    struct Pending *entry;
+    size_t consumed = 0;
+    ssize_t got;
+    int result;
+
+    got = recv(observer, rx + rx_pos, sizeof(rx) - rx_pos, 0);
+    if (got <= 0)
+    {
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            fprintf(stderr, "observer disconnected\n");
+            exit(1);
+        }
+        return;
+    }
+    rx_pos += got;
+    while ((result = wire_parse(format, rx + consumed, rx_pos - consumed, sizeof(rx), &view)) > 0)
+    {
+        consumed += result;
+        if (view.flags & FRAME_CONTROL)
+            continue;
+        entry = find_pending(payload_hash(view.msg, view.len));
+        if (entry->hash == 0 || entry->head < 0)
+            continue;
+        latencies[matched++] = now - records[entry->head].sent_ns;
+        entry->head = records[entry->head].next;
+    }
+    if (result < 0)
+    {
+        fprintf(stderr, "misframed stream, is -W right?\n");
+        exit(1);
+    }
+    rx_pos = frame_compact(rx, rx_pos, consumed);
+}
+
+/* Read whatever arrived, waiting up to timeout_ms for something */
+static void drain(int epfd, int timeout_ms)
+{
+    struct epoll_event events[EVENTS];
+    static char scratch[RX_BUFFER];
+    uint64_t now;
+    int n;
+    int i;
+
+    n = epoll_wait(epfd, events, EVENTS, timeout_ms);
+    now = now_ns();
+    for (i = 0; i < n; i++)
+    {
+        if (events[i].data.fd == observer)
+            observe(now);
+        else if (recv(events[i].data.fd, scratch, sizeof(scratch), 0) == 0)
+        {
+            fprintf(stderr, "relay closed a connection\n");
+            exit(1);
+        }
+    }
+}
+
+/* Send one record, reading meanwhile whenever its socket is full */
+static void send_record(int epfd, struct Record *record, uint64_t sequence)
+{
+    unsigned char header[WIRE_MAX_HEADER];
+    uint32_t len = record->word & FRAME_LENGTH_MASK;
+    struct iovec iov[2];
+    size_t header_len;
+    size_t done = 0;
+    ssize_t sent;
+
+    header_len = wire_header(format, header, len, record->word & ~FRAME_LENGTH_MASK, sequence);
+    while (done < header_len + len)
+    {
+        iov[0].iov_base = header + (done < header_len ? done : header_len);
+        iov[0].iov_len = done < header_len ? header_len - done : 0;
+        iov[1].iov_base = (char *)record->payload + (done > header_len ? done - header_len : 0);
+        iov[1].iov_len = len - (done > header_len ? done - header_len : 0);
+        sent = writev(fds[record->conn], iov, 2);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("send");
+                exit(1);
+            }
+            drain(epfd, 1);
+            continue;
+        }
+        if (done == 0)
+            record->sent_ns = now_ns();
+        done += sent;
+    }
+}
+
+static double percentile(double p)
+{
+    size_t i = (size_t)(p * (matched - 1));
+
+    return latencies[i] / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    struct epoll_event event;
+    struct Pending *entry;
+    const char *addr = "127.0.0.1";
+    double speed = 1;
+    uint64_t start;
+    uint64_t target;
+    uint64_t now;
+    uint64_t last;
+    uint64_t bytes = 0;
+    uint64_t hash;
+    size_t i;
+    int port = 8080;
+    int epfd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:s:W:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            addr = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'W':
+            format = strcmp(optarg, "fixed") == 0 ? WIRE_FIXED : strcmp(optarg, "compact") == 0 ? WIRE_COMPACT : WIRE_LEGACY;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a addr] [-p port] [-s speed, 0 for max] [-W format] capture\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || load(argv[optind]) != 0)
+        return 1;
+    if (record_count == 0)
+    {
+        fprintf(stderr, "empty capture\n");
+        return 1;
+    }
+
+    /* One connection per captured client, in id order */
+    ids = malloc(record_count * sizeof(uint64_t));
+    for (i = 0; i < record_count; i++)
+        ids[i] = records[i].id;
+    qsort(ids, record_count, sizeof(uint64_t), compare_ids);
+    for (i = 0; i < record_count; i++)
+    {
+        if (conn_count == 0 || ids[conn_count - 1] != ids[i])
+            ids[conn_count++] = ids[i];
+    }
+    for (i = 0; i < record_count; i++)
+        records[i].conn = (uint64_t *)bsearch(&records[i].id, ids, conn_count, sizeof(uint64_t), compare_ids) - ids;
+
+    /* Every data frame is expected once at the observer */
+    for (pending_mask = 1; pending_mask < 2 * record_count; pending_mask <<= 1)
+        continue;
+    pending = calloc(pending_mask--, sizeof(struct Pending));
+    latencies = malloc(record_count * sizeof(uint64_t));
+    if (ids == NULL || pending == NULL || latencies == NULL)
+        return 1;
+
+    epfd = epoll_create1(0);
+    fds = malloc(conn_count * sizeof(int));
+    event.events = EPOLLIN;
+    for (i = 0; i < conn_count; i++)
+    {
+        fds[i] = dial(addr, port);
+        event.data.fd = fds[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &event);
+    }
+    observer = dial(addr, port);
+    event.data.fd = observer;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, observer, &event);
+    usleep(200000);
+
+    printf("%zu frames from %zu clients over %.3f s captured, ", record_count, conn_count, records[record_count - 1].at / 1e9);
+    if (speed > 0)
+        printf("replaying at x%g\n", speed);
+    else
+        printf("replaying at full speed\n");
+
+    start = now_ns();
+    for (i = 0; i < record_count; i++)
+    {
+        /* Sleep most of the way to the frame's time, then spin on the sockets */
+        if (speed > 0)
+        {
+            target = start + (uint64_t)(records[i].at / speed);
+            while ((now = now_ns()) < target)
+                drain(epfd, target - now > 2000000 ? (int)((target - now) / 1000000) - 1 : 0);
+        }
+        else
+            drain(epfd, 0);
+
+        send_record(epfd, &records[i], i);
+        bytes += records[i].word & FRAME_LENGTH_MASK;
+        if (!(records[i].word & FRAME_CONTROL))
+        {
+            hash = payload_hash(records[i].payload, records[i].word & FRAME_LENGTH_MASK);
+            entry = find_pending(hash);
+            if (entry->hash == 0)
+            {
+                entry->hash = hash;
+                entry->head = -1;
+            }
+            if (entry->head < 0)
+                entry->head = (int)i;
+            else
+                records[entry->tail].next = (int)i;
+            entry->tail = (int)i;
+            expected++;
+        }
+    }
+    now = now_ns();
+    printf("sent   %12.0f frames/s %10.1f MB/s in %.3f s\n", record_count * 1e9 / (now - start), bytes * 1e3 / (now - start),
+           (now - start) / 1e9);
+
+    /* Collect what is still in flight */
+    last = now;
+    while (matched < expected && now_ns() - last < SETTLE_NS)
+    {
+        i = matched;
+        drain(epfd, 10);
+        if (matched != i)
+            last = now_ns();
+    }
+
+    printf("relayed %zu of %zu data frames to the observer\n", matched, expected);
+    if (matched > 0)
+    {
+        qsort(latencies, matched, sizeof(uint64_t), compare_ids);
+        printf("latency us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", percentile(0.5), percentile(0.9),
+               percentile(0.99), percentile(0.999), latencies[matched - 1] / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Tests for the client id index: ids handed out in order and never reused,
+ * growth past half full, and removal. Linear probing with backward shift
+ * deletion leaves no tombstones, so after every removal each remaining id
+ * must still be found, the removed one must not be, and the occupied slots
+ * must add up to the count.
+ *
+ *   make check
+ */
+#include <stdint.h>
+
+#include "route.h"
+#include "check.h"
+
+#define CHURN_ROUNDS 2000
+
+static struct ClientConnection *client_of(uint64_t id)
+{
+    return (struct ClientConnection *)(uintptr_t)(id * 16);
+}
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* Every live id is found and maps to its client; nothing else is in the table */
+static void check_table(struct RouteTable *table, const uint64_t *live, uint32_t count)
+{
+    uint32_t used = 0;
+    uint32_t i;
+
+    CHECK(table->count == count);
+    for (i = 0; i <= table->mask; i++)
+        used += table->slots[i].id != 0;
+    CHECK(used == count);
+    for (i = 0; i < count; i++)
+        CHECK(route_find(table, live[i]) == client_of(live[i]));
+}
+
+static void test_add_and_grow(void)
+{
+    struct RouteTable table;
+    uint64_t live[1000];
+    uint64_t id;
+    uint32_t i;
+
+    CHECK(route_init(&table) == 0);
+    CHECK(table.mask + 1 == ROUTE_CAPACITY);
+    CHECK(route_find(&table, 0) == NULL);
+    CHECK(route_find(&table, 1) == NULL);
+
+    for (i = 0; i < 1000; i++)
+    {
+        id = route_add(&table, client_of(i + 1));
+        CHECK(id == i + 1);
+        live[i] = id;
+
+        /* Never more than half full */
+        CHECK(table.count * 2 <= table.mask + 1);
+    }
+    CHECK(table.mask + 1 == 2048);
+    check_table(&table, live, 1000);
+    route_free(&table);
+}
+
+static void test_remove(void)
+{
+    struct RouteTable table;
+    uint64_t live[ROUTE_CAPACITY / 2];
+    uint32_t count = 0;
+    uint32_t pick;
+    uint64_t gone;
+    int round;
+
+    /* Stay within the initial table so chains keep colliding and wrapping */
+    CHECK(route_init(&table) == 0);
+    for (round = 0; round < CHURN_ROUNDS; round++)
+    {
+        while (count < ROUTE_CAPACITY / 2)
+        {
+            live[count] = table.next_id;
+            CHECK(route_add(&table, client_of(live[count])) == live[count]);
+            count++;
+        }
+        CHECK(table.mask + 1 == ROUTE_CAPACITY);
+        check_table(&table, live, count);
+
+        /* Remove at random down to a few, checking the chains after each */
+        while (count > (uint32_t)(round % 8))
+        {
+            pick = next_random() % count;
+            gone = live[pick];
+            route_remove(&table, gone);
+            live[pick] = live[--count];
+            CHECK(route_find(&table, gone) == NULL);
+            check_table(&table, live, count);
+
+            /* Removing it again, or an id never handed out, changes nothing */
+            route_remove(&table, gone);
+            route_remove(&table, table.next_id + 7);
+            route_remove(&table, 0);
+            check_table(&table, live, count);
+        }
+    }
+    route_free(&table);
+}
+
+int main(void)
+{
+    test_add_and_grow();
+    test_remove();
+    printf("route_test: ok\n");
+    return 0;
+}
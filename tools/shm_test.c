@@ -0,0 +1,133 @@
+/*
+ * Tests for shared memory clients of a relay in every framing: the
+ * handshake on the unix socket is always in the legacy framing, and once
+ * it is done a frame one client writes into its ring in the relay's
+ * framing comes out of another client's ring with the same flags and
+ * payload. The relay runs on its own thread, as an embedder would run it.
+ *
+ *   make check
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "relay.h"
+#include "shm.h"
+#include "wire.h"
+#include "check.h"
+
+#define WAIT_MS 5000
+
+static const int formats[] = {WIRE_LEGACY, WIRE_FIXED, WIRE_COMPACT};
+
+static int stopping;
+
+static void *run(void *arg)
+{
+    struct Relay *relay = (struct Relay *)arg;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+        CHECK(relay_run_once(relay, 10) == 0);
+    return NULL;
+}
+
+static int open_client(const char *path, struct ShmChannel *channel)
+{
+    struct timeval timeout = {WAIT_MS / 1000, 0};
+    struct sockaddr_un addr;
+    int sock;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(sock >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    CHECK(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    /* A relay that does not take the request fails the check, not hangs it */
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    shm_init(channel);
+    CHECK(shm_open_client(channel, sock, SHM_RING_MIN) == 0);
+    CHECK(channel->in.size == SHM_RING_MIN);
+    return sock;
+}
+
+/* Read one whole frame from ring, giving the relay up to WAIT_MS to send it */
+static int read_frame(struct ShmRing *ring, int format, char *buf, size_t size, struct FrameView *view)
+{
+    size_t pos = 0;
+    int result;
+    int waited;
+
+    for (waited = 0; waited < WAIT_MS; waited++)
+    {
+        pos += shm_get(ring, buf + pos, size - pos);
+        result = wire_parse(format, buf, pos, size, view);
+        if (result != 0)
+            return result;
+        usleep(1000);
+    }
+    return 0;
+}
+
+static void test_format(int format)
+{
+    static const char payload[] = "price 101.25";
+    struct RelayConfig config;
+    struct Relay *relay;
+    struct ShmChannel publisher;
+    struct ShmChannel subscriber;
+    struct FrameView view;
+    pthread_t thread;
+    char path[64];
+    char frame[256];
+    char got[256];
+    size_t header;
+    int publisher_sock;
+    int subscriber_sock;
+
+    snprintf(path, sizeof(path), "/tmp/shm_test.%d.sock", (int)getpid());
+    relay_config_init(&config);
+    config.port = 0;
+    config.unixPath = path;
+    config.wire = format;
+    relay = relay_new(&config, NULL);
+    CHECK(relay != NULL);
+    CHECK(relay_listen(relay) == 0);
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    CHECK(pthread_create(&thread, NULL, run, relay) == 0);
+
+    subscriber_sock = open_client(path, &subscriber);
+    publisher_sock = open_client(path, &publisher);
+
+    header = wire_header(format, (unsigned char *)frame, sizeof(payload) - 1, FRAME_PRIORITY, 1);
+    memcpy(frame + header, payload, sizeof(payload) - 1);
+    CHECK(shm_put(&publisher.out, frame, header + sizeof(payload) - 1) == header + sizeof(payload) - 1);
+
+    CHECK(read_frame(&subscriber.in, format, got, sizeof(got), &view) > 0);
+    CHECK(view.flags == FRAME_PRIORITY);
+    CHECK(view.len == sizeof(payload) - 1);
+    CHECK(memcmp(view.msg, payload, view.len) == 0);
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    CHECK(pthread_join(thread, NULL) == 0);
+    shm_close(&publisher);
+    shm_close(&subscriber);
+    close(publisher_sock);
+    close(subscriber_sock);
+    relay_free(relay);
+    unlink(path);
+}
+
+int main(void)
+{
+    unsigned int f;
+
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+        test_format(formats[f]);
+    printf("shm_test: ok\n");
+    return 0;
+}
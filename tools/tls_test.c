@@ -0,0 +1,214 @@
+/*
+ * Tests for the TLS listener, built by make TLS=1 check: the certificate
+ * and key named by tlsCert and tlsKey in a configuration file load, and a
+ * client completes the handshake with TLS 1.2 and 1.3 against a
+ * non-blocking server session over loopback. The server socket is still
+ * non-blocking afterwards. Where the kernel has TLS offload, plain bytes
+ * written to the socket must reach the client as records; elsewhere the
+ * server refuses the client once the handshake is done.
+ *
+ *   make TLS=1 check
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+
+#include "tls.h"
+#include "config.h"
+#include "check.h"
+
+#ifndef DAEMONIZE_TLS
+#error tls_test needs make TLS=1
+#endif
+
+#define STEPS 5000
+
+static const int versions[] = {TLS1_2_VERSION, TLS1_3_VERSION};
+
+/* A self-signed certificate for localhost, valid for an hour */
+static void write_certificate(const char *cert, const char *key)
+{
+    EVP_PKEY *pkey;
+    X509_NAME *name;
+    X509 *x509;
+    FILE *f;
+
+    pkey = EVP_EC_gen("P-256");
+    CHECK(pkey != NULL);
+    x509 = X509_new();
+    CHECK(x509 != NULL);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    CHECK(X509_set_pubkey(x509, pkey) == 1);
+    name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    CHECK(X509_set_issuer_name(x509, name) == 1);
+    CHECK(X509_sign(x509, pkey, EVP_sha256()) > 0);
+
+    f = fopen(cert, "w");
+    CHECK(f != NULL);
+    CHECK(PEM_write_X509(f, x509) == 1);
+    fclose(f);
+    f = fopen(key, "w");
+    CHECK(f != NULL);
+    CHECK(PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL) == 1);
+    fclose(f);
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+/* A connected loopback pair, both ends non-blocking */
+static void connect_pair(int *server, int *client)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int listener;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(listener >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(listen(listener, 1) == 0);
+    CHECK(getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(*client >= 0);
+    CHECK(connect(*client, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    *server = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+    CHECK(*server >= 0);
+    CHECK(fcntl(*client, F_SETFL, O_NONBLOCK) == 0);
+    close(listener);
+}
+
+/* Returns 1 if the kernel took over the session, 0 if the client was refused */
+static int handshake(SSL_CTX *server_ctx, int version)
+{
+    static const char frame[] = "\0\0\0\5hello";
+    char got[sizeof(frame)];
+    SSL_CTX *client_ctx;
+    SSL *client;
+    SSL *server;
+    int server_fd;
+    int client_fd;
+    int client_done = 0;
+    int server_result = TLS_WANT_READ;
+    int result;
+    int got_len = 0;
+    int step;
+
+    connect_pair(&server_fd, &client_fd);
+    server = tls_session_new(server_ctx, server_fd);
+    CHECK(server != NULL);
+
+    client_ctx = SSL_CTX_new(TLS_client_method());
+    CHECK(client_ctx != NULL);
+    SSL_CTX_set_min_proto_version(client_ctx, version);
+    SSL_CTX_set_max_proto_version(client_ctx, version);
+    client = SSL_new(client_ctx);
+    CHECK(client != NULL);
+    CHECK(SSL_set_fd(client, client_fd) == 1);
+    SSL_set_connect_state(client);
+
+    /* Both ends in one thread, each stepped until it stops waiting on the other */
+    for (step = 0; step < STEPS && (!client_done || server_result > 0); step++)
+    {
+        if (!client_done)
+        {
+            result = SSL_do_handshake(client);
+            client_done = result == 1;
+            if (!client_done)
+                CHECK(SSL_get_error(client, result) == SSL_ERROR_WANT_READ);
+        }
+        if (server_result > 0)
+            server_result = tls_handshake(server);
+        usleep(100);
+    }
+    CHECK(client_done);
+    CHECK(server_result != TLS_WANT_READ && server_result != TLS_WANT_WRITE);
+    CHECK(SSL_is_init_finished(server));
+    CHECK(SSL_version(client) == version);
+    CHECK(fcntl(server_fd, F_GETFL) & O_NONBLOCK);
+
+    /* With offload the relay writes plain frames and the kernel seals them */
+    if (server_result == 0)
+    {
+        CHECK(send(server_fd, frame, sizeof(frame) - 1, 0) == sizeof(frame) - 1);
+        for (step = 0; step < STEPS && got_len < (int)sizeof(frame) - 1; step++)
+        {
+            result = SSL_read(client, got + got_len, sizeof(got) - got_len);
+            if (result > 0)
+                got_len += result;
+            else
+                CHECK(SSL_get_error(client, result) == SSL_ERROR_WANT_READ);
+            usleep(100);
+        }
+        CHECK(got_len == sizeof(frame) - 1);
+        CHECK(memcmp(got, frame, got_len) == 0);
+    }
+
+    tls_session_free(server, server_result == 0);
+    SSL_free(client);
+    SSL_CTX_free(client_ctx);
+    close(server_fd);
+    close(client_fd);
+    return server_result == 0;
+}
+
+int main(void)
+{
+    char cert[64];
+    char key[64];
+    char conf[64];
+    char *conf_cert = NULL;
+    char *conf_key = NULL;
+    char *log_file = NULL;
+    int port = 0;
+    int max_clients = 0;
+    int level = 0;
+    int offloaded = 0;
+    SSL_CTX *ctx;
+    FILE *f;
+    unsigned int v;
+
+    snprintf(cert, sizeof(cert), "/tmp/tls_test.%d.cert", (int)getpid());
+    snprintf(key, sizeof(key), "/tmp/tls_test.%d.key", (int)getpid());
+    snprintf(conf, sizeof(conf), "/tmp/tls_test.%d.conf", (int)getpid());
+    write_certificate(cert, key);
+    f = fopen(conf, "w");
+    CHECK(f != NULL);
+    fprintf(f, "[relay]\nport = 9000\ntlsCert = %s\ntlsKey = %s\n", cert, key);
+    fclose(f);
+    CHECK(readConfig(conf, "relay", &port, &max_clients, &level, &log_file, &conf_cert, &conf_key) == 0);
+    CHECK(conf_cert != NULL && strcmp(conf_cert, cert) == 0);
+    CHECK(conf_key != NULL && strcmp(conf_key, key) == 0);
+    CHECK(log_file == NULL);
+
+    /* A file without the key is refused up front */
+    CHECK(tls_server_new(conf_cert, conf_cert) == NULL);
+    ctx = tls_server_new(conf_cert, conf_key);
+    CHECK(ctx != NULL);
+    for (v = 0; v < sizeof(versions) / sizeof(versions[0]); v++)
+        offloaded += handshake(ctx, versions[v]);
+    tls_server_free(ctx);
+
+    unlink(cert);
+    unlink(key);
+    unlink(conf);
+    free(conf_cert);
+    free(conf_key);
+    if (offloaded == 0)
+        printf("tls_test: no kernel tls here, handshakes checked without offload\n");
+    printf("tls_test: ok\n");
+    return 0;
+}
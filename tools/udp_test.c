@@ -0,0 +1,167 @@
+/*
+ * Tests for the datagram relay over loopback: every datagram read in a
+ * batch reaches every subscriber unchanged and in order, both packed into
+ * GSO runs and one send per datagram. Runs break at a size change, a short
+ * tail and the GSO byte limit; truncated and empty datagrams are dropped.
+ *
+ *   make check
+ */
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "udp.h"
+#include "check.h"
+
+#define SUBSCRIBERS 2
+
+/* Big enough to need several batches and to cross the GSO byte limit */
+#define MAX_SENT 80
+
+/* Holds a full batch for every subscriber, too big for the stack */
+static struct UdpRelay udp;
+
+static int local_port(int sock)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    CHECK(getsockname(sock, (struct sockaddr *)&addr, &len) == 0);
+    return ntohs(addr.sin_port);
+}
+
+static int open_subscriber(void)
+{
+    struct sockaddr_in addr;
+    int size = 1 << 20;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sock >= 0);
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return sock;
+}
+
+/* Payload of the n'th datagram, so a reordered or mixed up copy shows */
+static void fill(char *buf, size_t len, int n)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (char)(n * 31 + i);
+}
+
+/*
+ * Send datagrams of the given sizes to the relay, relay them in as many
+ * batches as it takes and check what each subscriber got.
+ */
+static void relay_sizes(int gso, const size_t *sizes, int count)
+{
+    static char buf[4096];
+    static char got[4096];
+    struct sockaddr_in to;
+    char endpoint[32];
+    int subscribers[SUBSCRIBERS];
+    int sender;
+    int relayed;
+    int batch;
+    ssize_t n;
+    int i;
+    int s;
+
+    CHECK(count <= MAX_SENT);
+    CHECK(udp_open(&udp, 0, NULL) == 0);
+    if (!gso)
+        udp.gso = 0;
+    for (s = 0; s < SUBSCRIBERS; s++)
+    {
+        subscribers[s] = open_subscriber();
+        snprintf(endpoint, sizeof(endpoint), "127.0.0.1:%d", local_port(subscribers[s]));
+        CHECK(udp_add_subscriber(&udp, endpoint) == 0);
+    }
+
+    sender = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(sender >= 0);
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(local_port(udp.sock));
+    for (i = 0; i < count; i++)
+    {
+        CHECK(sizes[i] <= sizeof(buf));
+        fill(buf, sizes[i], i);
+        CHECK(sendto(sender, buf, sizes[i], 0, (struct sockaddr *)&to, sizeof(to)) == (ssize_t)sizes[i]);
+    }
+
+    /* Loopback delivers before sendto returns, so every batch is full but the last */
+    relayed = 0;
+    while (relayed < count)
+    {
+        batch = udp_relay_batch(&udp);
+        CHECK(batch == (count - relayed < UDP_BATCH ? count - relayed : UDP_BATCH));
+        relayed += batch;
+    }
+    CHECK(udp_relay_batch(&udp) == 0);
+
+    for (s = 0; s < SUBSCRIBERS; s++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (sizes[i] == 0 || sizes[i] > UDP_MAX_DATAGRAM)
+                continue;
+            n = recv(subscribers[s], got, sizeof(got), MSG_DONTWAIT);
+            CHECK(n == (ssize_t)sizes[i]);
+            fill(buf, sizes[i], i);
+            CHECK(memcmp(got, buf, sizes[i]) == 0);
+        }
+        CHECK(recv(subscribers[s], got, sizeof(got), MSG_DONTWAIT) == -1);
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+        close(subscribers[s]);
+    }
+    close(sender);
+    udp_close(&udp);
+}
+
+static void test_mixed(int gso)
+{
+    /* A run of equal sizes with a short tail, a bigger size, one too big, an empty one */
+    static const size_t sizes[] = {100, 100, 100, 100, 100, 40, 200, 200, 3000, 7, 0, 50, 1472, 1};
+
+    relay_sizes(gso, sizes, sizeof(sizes) / sizeof(sizes[0]));
+}
+
+static void test_full(int gso)
+{
+    size_t sizes[MAX_SENT];
+    int i;
+
+    /* More than one batch, and more bytes than one GSO send may carry */
+    for (i = 0; i < MAX_SENT; i++)
+        sizes[i] = UDP_MAX_DATAGRAM;
+    relay_sizes(gso, sizes, MAX_SENT);
+
+    /* Every size different, so no two datagrams share a run */
+    for (i = 0; i < MAX_SENT; i++)
+        sizes[i] = 1 + i * 17;
+    relay_sizes(gso, sizes, MAX_SENT);
+}
+
+int main(void)
+{
+    int gso;
+
+    for (gso = 0; gso <= 1; gso++)
+    {
+        test_mixed(gso);
+        test_full(gso);
+    }
+    printf("udp_test: ok\n");
+    return 0;
+}
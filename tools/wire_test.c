@@ -0,0 +1,143 @@
+/*
+ * Round trip tests for the framings: every header wire_header() writes must
+ * come back from wire_parse() with the same length, flags and payload, the
+ * header size must match wire_header_size(), and every shorter prefix of
+ * the frame must read as incomplete. Lengths sit on the varint boundaries.
+ *
+ *   make check
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wire.h"
+#include "check.h"
+
+#define MAX_PAYLOAD (1u << 21)
+
+static const int formats[] = {WIRE_LEGACY, WIRE_FIXED, WIRE_COMPACT};
+static const uint32_t flag_sets[] = {0, FRAME_PRIORITY, FRAME_CONTROL, FRAME_CONTROL | FRAME_PRIORITY};
+static const uint32_t lengths[] = {0, 1, 2, 63, 64, 127, 128, 129, 255, 256, 1000, 16383, 16384, 16385, 65535, 65536,
+                                   MAX_PAYLOAD - 1, MAX_PAYLOAD};
+
+static void test_varints(void)
+{
+    unsigned char buf[16];
+    uint64_t value;
+    uint64_t got;
+    int bits;
+    int n;
+
+    for (bits = 0; bits <= 35; bits++)
+    {
+        for (value = bits == 0 ? 0 : (1ull << bits) - 1; value <= (1ull << bits) && value < (1ull << 35); value++)
+        {
+            memset(buf, 0xa5, sizeof(buf));
+            n = wire_varint_encode(buf, value);
+            CHECK(n == wire_varint_size(value));
+            CHECK(n >= 1 && n <= WIRE_VARINT_MAX);
+            /* Seven value bits per byte, the byte count in unary at the bottom */
+            CHECK(n == 1 || value >= 1ull << (7 * (n - 1)));
+            CHECK(value < 1ull << (7 * n));
+            CHECK(wire_varint_decode(buf, &got) == n);
+            CHECK(got == value);
+        }
+    }
+
+    /* A first byte claiming more than WIRE_VARINT_MAX bytes is refused */
+    memset(buf, 0, sizeof(buf));
+    CHECK(wire_varint_decode(buf, &got) == -1);
+    buf[0] = 0x80;
+    CHECK(wire_varint_decode(buf, &got) == -1);
+    buf[0] = 0x20;
+    CHECK(wire_varint_decode(buf, &got) == -1);
+}
+
+static void test_round_trip(char *buf)
+{
+    struct WireFixedHeader fixed;
+    struct FrameView view;
+    size_t header;
+    size_t total;
+    size_t cut;
+    uint32_t len;
+    uint32_t flags;
+    unsigned int f;
+    unsigned int l;
+    unsigned int s;
+    uint64_t sequence = 0;
+
+    for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+        {
+            for (s = 0; s < sizeof(flag_sets) / sizeof(flag_sets[0]); s++)
+            {
+                len = lengths[l];
+                flags = flag_sets[s];
+                sequence = sequence * 31 + 7;
+                header = wire_header(formats[f], (unsigned char *)buf, len, flags, sequence);
+                CHECK(header == wire_header_size(formats[f], len));
+                CHECK(header <= WIRE_MAX_HEADER);
+                memset(buf + header, 'a' + l, len);
+                total = header + len;
+
+                CHECK(wire_parse(formats[f], buf, total, total, &view) == (int)total);
+                CHECK(view.len == len);
+                CHECK(view.flags == flags);
+                CHECK(view.msg == buf + header);
+                if (formats[f] == WIRE_FIXED)
+                {
+                    wire_fixed_decode((const unsigned char *)buf, &fixed);
+                    CHECK(fixed.sequence == sequence);
+                }
+
+                /* More data behind the frame is left alone */
+                CHECK(wire_parse(formats[f], buf, total + 1, total + 1, &view) == (int)total);
+
+                /* A full buffer one byte short can never hold it */
+                if (len > 0)
+                    CHECK(wire_parse(formats[f], buf, total - 1, total - 1, &view) == -1);
+
+                /* Until the last byte is in, the frame is incomplete */
+                for (cut = 0; cut < total; cut = cut < 64 ? cut + 1 : cut * 2 + 1)
+                    CHECK(wire_parse(formats[f], buf, cut, total, &view) == 0);
+                CHECK(wire_parse(formats[f], buf, total - 1, total, &view) == 0);
+            }
+        }
+    }
+}
+
+static void test_version(char *buf)
+{
+    struct FrameView view;
+    size_t header;
+
+    header = wire_header(WIRE_FIXED, (unsigned char *)buf, 3, 0, 1);
+    buf[0] = WIRE_VERSION_FIXED + 1;
+    CHECK(wire_parse(WIRE_FIXED, buf, header + 3, 64, &view) == -1);
+
+    header = wire_header(WIRE_COMPACT, (unsigned char *)buf, 3, 0, 1);
+    buf[0] = (char)((WIRE_VERSION_COMPACT + 1) << 4);
+    CHECK(wire_parse(WIRE_COMPACT, buf, header + 3, 64, &view) == -1);
+
+    /* Each framing refuses the other's headers */
+    header = wire_header(WIRE_COMPACT, (unsigned char *)buf, 3, 0, 1);
+    memset(buf + header, 0, 32);
+    CHECK(wire_parse(WIRE_FIXED, buf, 32, 64, &view) == -1);
+    wire_header(WIRE_FIXED, (unsigned char *)buf, 3, 0, 1);
+    CHECK(wire_parse(WIRE_COMPACT, buf, 32, 64, &view) == -1);
+}
+
+int main(void)
+{
+    char *buf;
+
+    buf = calloc(1, WIRE_MAX_HEADER + MAX_PAYLOAD + 1);
+    CHECK(buf != NULL);
+    test_varints();
+    test_round_trip(buf);
+    test_version(buf);
+    free(buf);
+    printf("wire_test: ok\n");
+    return 0;
+}